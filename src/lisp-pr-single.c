@@ -17,6 +17,14 @@
 #include <string.h>
 #include <setjmp.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define link unistd_link        /* <unistd.h> declares link(), which is also the name of our GC function */
+#include <unistd.h>             /* isatty() to run in batch mode when stdin is not a terminal */
+#undef link
+#else
+#define isatty(fd) 1
+#endif
+
 #ifdef HAVE_SIGNAL_H
 #include <signal.h>             /* to catch CTRL-C and continue the REPL */
 #define BREAK_ON  signal(SIGINT, (void(*)(int))err)
@@ -43,6 +51,13 @@ void using_history() { }
 #define ALWAYS_GC 0
 #endif
 
+/* STATS: count garbage collections and track the peak stack depth, reported to stderr by (quit) */
+#ifdef STATS
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
+
 /*----------------------------------------------------------------------------*\
  |      LISP EXPRESSION TYPES AND NAN BOXING                                  |
 \*----------------------------------------------------------------------------*/
@@ -147,6 +162,9 @@ L cell[N];
    tr: 0 when tracing is off, 1 or 2 to trace Lisp evaluation steps */
 I fp = 0, hp = H, sp = N, tr = 0;
 
+/* the number of garbage collections and the lowest stack pointer, when compiled with -DSTATS */
+I gcs = 0, ms = N;
+
 /* Lisp constant expressions () (nil) and #t, and the global environment env */
 L nil, tru, env;
 
@@ -235,6 +253,7 @@ void compact() {
 I gc() {
   I i;
   BREAK_OFF;                                    /* do not interrupt GC */
+  STAT(++gcs);
   memset(used, 0, sizeof(used));                /* clear all used[] bits */
   if (T(env) == CONS)
     mark(ord(env));                             /* mark all globally-used cons cell pairs referenced from env list */
@@ -250,9 +269,10 @@ I gc() {
 /* push x on the stack to protect it from being recycled, returns pointer to cell pair (e.g. to update the value) */
 L *push(L x) {
   cell[--sp] = x;                               /* we must save x on the stack so it won't get GC'ed */
-  if (hp > (sp-1) << 3 || ALWAYS_GC) {          /* if insufficient stack space is available, then GC */
+  STAT(if (sp < ms) ms = sp);                   /* track the peak stack depth */
+  if (hp > sizeof(L)*(sp-1) || ALWAYS_GC) {     /* if insufficient stack space is available, then GC */
     gc();                                       /* GC */
-    if (hp > (sp-1) << 3)                       /* GC did not free up heap space to enlarge the stack */
+    if (hp > sizeof(L)*(sp-1))                  /* GC did not free up heap space to enlarge the stack */
       err(6);
   }
   return &cell[sp];
@@ -276,9 +296,9 @@ void unwind(I i) {
 I alloc(I n) {
   I i = hp+R;                                   /* free atom/heap is located at hp+R */
   n += R+1;                                     /* n+R+1 is the space we need to reserve */
-  if (hp+n > (sp-1) << 3 || ALWAYS_GC) {        /* if insufficient heap space is available, then GC */
+  if (hp+n > sizeof(L)*(sp-1) || ALWAYS_GC) {   /* if insufficient heap space is available, then GC */
     gc();                                       /* GC */
-    if (hp+n > (sp-1) << 3)                     /* GC did not free up sufficient heap/stack space */
+    if (hp+n > sizeof(L)*(sp-1))                /* GC did not free up sufficient heap/stack space */
       err(6);
     i = hp+R;                                   /* new atom/string is located at hp+R on the heap */
   }
@@ -373,13 +393,19 @@ I more(L t) {
 I fin = 0;
 FILE *in[10];
 
+/* batch mode is nonzero to read the input files without prompts, the input ends at the end of the files */
+I batch = 0;
+
 /* specify an input file to parse and try to open it */
 FILE *input(const char *s) {
   return fin <= 9 && (in[fin] = fopen(s, "r")) ? in[fin++] : NULL;
 }
 
 /* tokenization buffer, the next character we're looking at, the readline line, prompt and input file */
-char buf[256], see = '\n', *ptr = "", *line = NULL, ps[20];
+char *buf = NULL, see = '\n', *ptr = "", *line = NULL, ps[20];
+
+/* size of the tokenization buffer that grows as needed */
+I bn = 0;
 
 /* return the character we see, advance to the next character */
 char get() {
@@ -391,6 +417,8 @@ char get() {
       see = '\n';                               /* pretend we see a newline at eof */
     }
   }
+  else if (batch)                               /* in batch mode there is no input after the input files */
+    ERR(8, "unexpected end ");
   else {
 #ifdef HAVE_READLINE_H
     if (see == '\n') {                          /* if looking at the end of the current readline line */
@@ -426,6 +454,28 @@ I seeing(char c) {
   return c == ' ' ? see > 0 && see <= c : see == c;
 }
 
+/* skip white space and ;-comments in the input files, returns nonzero when all input files are read */
+I eof() {
+  while (fin && (seeing(' ') || seeing(';')))
+    if (get() == ';')
+      while (fin && !seeing('\n'))            /* skip ;-comment until newline */
+        get();
+  return !fin;
+}
+
+/* add character c to the token in buf[] at position i, doubles the size of buf[] when full */
+void add(I i, char c) {
+  if (i+1 >= bn) {                              /* if buf[] is full, then double its size */
+    I n = bn ? 2*bn : 256;
+    char *b = (char*)realloc(buf, n);
+    if (!b)
+      err(7);
+    buf = b;
+    bn = n;
+  }
+  buf[i] = c;
+}
+
 /* tokenize into buf[], return first character of buf[] */
 char scan() {
   I i = 0;
@@ -435,26 +485,26 @@ char scan() {
         get();
   if (seeing('"')) {                            /* tokenize a quoted string */
     do {
-      buf[i++] = get();
-      while (seeing('\\') && i < sizeof(buf)-1) {
+      add(i++, get());
+      while (seeing('\\')) {
         static const char *abtnvfr = "abtnvfr"; /* \a, \b, \t, \n, \v, \f, \r escape codes */
         const char *esc;
         get();
         esc = strchr(abtnvfr, see);
-        buf[i++] = esc ? esc-abtnvfr+7 : see;   /* replace \x with an escaped code or x itself */
+        add(i++, esc ? esc-abtnvfr+7 : see);    /* replace \x with an escaped code or x itself */
         get();
       }
     }
-    while (i < sizeof(buf)-1 && !seeing('"') && !seeing('\n'));
+    while (!seeing('"') && !seeing('\n'));
     if (get() != '"')
       ERR(8, "missing \" ");
   }
   else if (seeing('(') || seeing(')') || seeing('\''))
-    buf[i++] = get();                           /* ( ) ' are single-character tokens */
+    add(i++, get());                            /* ( ) ' are single-character tokens */
   else                                          /* tokenize a symbol or a number */
     do
-      buf[i++] = get();
-    while (i < sizeof(buf)-1 && !seeing('(') && !seeing(')') && !seeing(' '));
+      add(i++, get());
+    while (!seeing('(') && !seeing(')') && !seeing(' '));
   buf[i] = 0;
   return *buf;                                  /* return first character of token in buf[] */
 }
@@ -483,9 +533,18 @@ L list() {
   }
 }
 
+/* return nonzero if the token in buf[] is a number and store its value in x, including inf, -inf and nan */
+I number(L *x) {
+  char *e, c = buf[*buf == '+' || *buf == '-'];
+  if ((c < '0' || c > '9') && c != '.' && (c|32) != 'i' && (c|32) != 'n')
+    return 0;                                   /* quickly reject symbols by their first one or two characters */
+  *x = strtof(buf, &e);
+  return e > buf && !*e;
+}
+
 /* return a parsed Lisp expression */
 L parse() {
-  L x; I i;
+  L x;
   if (*buf == '(')                              /* if token is ( then parse a list */
     return list();
   if (*buf == '\'') {                           /* if token is ' then parse an expression x to return (quote x) */
@@ -494,7 +553,7 @@ L parse() {
   }
   if (*buf == '"')                              /* if token is a string, then return a new string */
     return string(buf+1);
-  if (sscanf(buf, "%g%n", &x, &i) > 0 && !buf[i])
+  if (number(&x))
     return x;                                   /* return a number, including inf, -inf and nan */
   if (*buf != ')')
     return atom(buf);                           /* return an atom (a symbol) */
@@ -638,7 +697,8 @@ L f_macro(L t, L *_) {
 }
 
 L f_define(L t, L *e) {
-  env = pair(car(t), eval(car(cdr(t)), *e), env);
+  L x = eval(car(cdr(t)), *e);
+  env = pair(car(t), x, env);
   return car(t);
 }
 
@@ -652,14 +712,18 @@ L f_env(L _, L *e) {
 
 L f_let(L t, L *e) {
   L d = *e;
-  for (; more(t); t = cdr(t))
-    *e = pair(car(car(t)), eval(f_begin(cdr(car(t)), &d), d), *e);
+  for (; more(t); t = cdr(t)) {
+    L x = eval(f_begin(cdr(car(t)), &d), d);
+    *e = pair(car(car(t)), x, *e);
+  }
   return T(t) == NIL ? nil : car(t);
 }
 
 L f_leta(L t, L *e) {
-  for (; more(t); t = cdr(t))
-    *e = pair(car(car(t)), eval(f_begin(cdr(car(t)), e), *e), *e);
+  for (; more(t); t = cdr(t)) {
+    L x = eval(f_begin(cdr(car(t)), e), *e);
+    *e = pair(car(car(t)), x, *e);
+  }
   return T(t) == NIL ? nil : car(t);
 }
 
@@ -741,7 +805,7 @@ L f_string(L t, L *_) {
       for (; T(x) == CONS; x = cdr(x))
         ++i;
     else if (x == x) /* false when x is NaN i.e. a tagged Lisp expression */
-      i += snprintf(buf, sizeof(buf), FLOAT, x);
+      i += snprintf(NULL, 0, FLOAT, x);
   }
   push(t);
   i = j = alloc(i);
@@ -754,7 +818,7 @@ L f_string(L t, L *_) {
       for (; T(x) == CONS; x = cdr(x))
         *(A+i++) = car(x);
     else if (x == x) /* false when x is NaN i.e. a tagged Lisp expression */
-      i += snprintf(A+i, sizeof(buf), FLOAT, x);
+      i += sprintf(A+i, FLOAT, x);
   }
   *(A+i) = 0;
   return box(STRG, j);
@@ -787,6 +851,7 @@ L f_throw(L t, L *_) {
 }
 
 L f_quit(L t, L *_) {
+  STAT(fprintf(stderr, "gc %u stack %u\n", gcs, N-ms));
   exit(0);
 }
 
@@ -880,7 +945,8 @@ L step(L x, L e) {
         *d = env;
       v = car(car(*f));                         /* get the parameters v of closure f */
       while (T(v) == CONS && T(x) == CONS) {    /* bind parameters v to argument values x to extend the local scope d */
-        *d = pair(car(v), eval(car(x), e), *d); /* add new binding to the front of d */
+        *y = eval(car(x), e);                   /* evaluate argument x, GC may move atom car(v) on the heap */
+        *d = pair(car(v), *y, *d);              /* add new binding to the front of d */
         v = cdr(v);
         x = cdr(x);
       }
@@ -895,10 +961,11 @@ L step(L x, L e) {
           err(4);
         x = *y;
       }
-      else if (T(x) == CONS)                    /* if more arguments x are provided then evaluate them all */
-        x = evlis(x, e);
-      else if (T(x) != NIL)                     /* else if last argument x is after a dot (... . x) then evaluate x */
-        x = eval(x, e);
+      else if (T(x) != NIL) {                   /* if more arguments x are provided then evaluate them */
+        *y = v;                                 /* protect atom v, GC may move it on the heap */
+        x = T(x) == CONS ? evlis(x, e) : eval(x, e); /* evaluate them all or evaluate x after a dot (... . x) */
+        v = *y;
+      }
       if (T(v) != NIL)                          /* if last parameter v is after a dot (... . v) then bind it to x */
         *d = pair(v, x, *d);
       x = *y = cdr(car(*f));                    /* tail recursion optimization: evaluate the body x of closure f next */
@@ -986,10 +1053,38 @@ void print(L x) {
 \*----------------------------------------------------------------------------*/
 
 /* entry point with Lisp initialization, error handling and REPL */
+/* usage: lisp [-f script.lisp | -e expr]... [init.lisp]
+   runs the REPL after loading init.lisp, or runs in batch mode with option -f or -e or when stdin is not a terminal */
 int main(int argc, char **argv) {
-  int i;
-  printf("lisp");
-  input(argc > 1 ? argv[1] : "init.lisp");      /* set input source to load when available */
+  int i, j, k = 0, args[8];
+  const char *init = "init.lisp";
+  for (i = 1; i < argc; ++i) {                  /* collect the -f script and -e expression arguments */
+    if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "-e")) && i+1 < argc) {
+      if (k == 8) {                             /* in[] holds the scripts, the init file and stdin */
+        fprintf(stderr, "too many -f and -e options\n");
+        return EXIT_FAILURE;
+      }
+      args[k++] = ++i;
+    }
+    else
+      init = argv[i];
+  }
+  if (k || !isatty(0)) {                        /* batch mode */
+    batch = 1;
+    if (!k)
+      in[fin++] = stdin;                        /* read stdin last */
+    for (j = k; j--; ) {                        /* push the scripts and expressions in reverse order to read first */
+      i = args[j];
+      if (!(in[fin] = strcmp(argv[i-1], "-e") ? fopen(argv[i], "r") : fmemopen(argv[i], strlen(argv[i]), "r"))) {
+        fprintf(stderr, "cannot read %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      ++fin;
+    }
+  }
+  else
+    printf("lisp");
+  input(init);                                  /* set input source to load when available */
   out = stdout;
   if (setjmp(jb))                               /* if something goes wrong before REPL, it is fatal */
     abort();
@@ -1005,13 +1100,25 @@ int main(int argc, char **argv) {
   if (i) {
     while (fin)                                 /* close all open files */
       fclose(in[--fin]);
+    if (batch) {                                /* errors end batch mode with a failure exit status */
+      fflush(stdout);
+      fprintf(stderr, "ERR %d: %s\n", i, errors[i > 0 && i <= ERRORS ? i : 0]);
+      return EXIT_FAILURE;
+    }
     printf("ERR %d: %s", i, errors[i > 0 && i <= ERRORS ? i : 0]);
   }
+  if (batch) {                                  /* evaluate the input without prompts and without GC between forms */
+    while (!eof()) {
+      unwind(N);
+      eval(*push(readlisp()), env);
+    }
+    return 0;
+  }
   while (1) {                                   /* read-evel-print loop */
     putchar('\n');
     unwind(N);
     i = gc();
-    snprintf(ps, sizeof(ps), "%u+%u>", i, sp-hp/8);
+    snprintf(ps, sizeof(ps), "%u+%u>", i, sp-hp/(I)sizeof(L));
     out = stdout;
     print(eval(*push(readlisp()), env));
   }
@@ -1,34 +1,88 @@
 // lisp-repl.cpp C++17 REPL demo by Robert A. van Engelen 2022 BSD-3 license
-// To enable readline: c++ -std=c++17 -o lisp lisp-repl.cpp -O2 -DHAVE_READLINE_H -lreadline
-// To enable break with CTRL-C: c++ -std=c++17 -o lisp lisp-repl.cpp -O2 -DHAVE_SIGNAL_H -DHAVE_READLINE_H -lreadline
+// To enable readline: c++ -std=c++17 -o lisp lisp-repl.cpp -O2 -pthread -DHAVE_READLINE_H -lreadline
+// To enable break with CTRL-C: c++ -std=c++17 -o lisp lisp-repl.cpp -O2 -pthread -DHAVE_SIGNAL_H -DHAVE_READLINE_H -lreadline
+// Usage: lisp [-f script.lisp | -e expr]... [init.lisp]
+// runs the REPL after loading init.lisp, or runs in batch mode with option -f or -e or when stdin is not a terminal
 
 #include "lisp.hpp"
 
-// a small Lisp interpreter with 8192 cells pool and 2048 cells stack/heap
+// a small Lisp interpreter with 8192 cells pool, 2048 cells heap and a separate stack
 typedef Lisp<8192,2048> MySmallLisp;
 
+// evaluate the Lisp expressions in the input files in batch mode, without prompts and without GC between forms
+static void run(MySmallLisp& lisp) {
+  while (!lisp.eof()) {
+    lisp.unwind();
+    lisp.eval(*lisp.push(lisp.read()), lisp.env);
+  }
+}
+
 int main(int argc, char **argv) {
-  printf("lisp");
+  const char *init = "init.lisp";
+  int args[8], k = 0;
+  for (int i = 1; i < argc; ++i) {      // collect the -f script and -e expression arguments
+    if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "-e")) && i+1 < argc) {
+      if (k == 8) {                     // the same limit as lisp.c
+        fprintf(stderr, "too many -f and -e options\n");
+        return EXIT_FAILURE;
+      }
+      args[k++] = ++i;
+    }
+    else
+      init = argv[i];
+  }
   MySmallLisp lisp;
-  lisp.input(argc > 1 ? argv[1] : "init.lisp");
-  using_history();
-  int i = GETSIGINT(lisp);      // when compiling with -DHAVE_SIGINT_H we must set this handler!
-  if (i) {
-    lisp.closein();
-    printf("ERR %d %s", i, lisp.error(i));
+  if (k || !isatty(0)) {                // batch mode
+    lisp.batch = 1;
+    GETSIGINT(lisp);                    // when compiling with -DHAVE_SIGNAL_H CTRL-C breaks the evaluation
+    try {
+      lisp.input(init);
+      run(lisp);
+      for (int j = 0; j < k; ++j) {
+        int i = args[j];
+        if (!strcmp(argv[i-1], "-e"))
+          lisp.eval_string(argv[i]);
+        else if (lisp.input(argv[i]))
+          run(lisp);
+        else {
+          fprintf(stderr, "cannot read %s\n", argv[i]);
+          return EXIT_FAILURE;
+        }
+      }
+      if (!k && lisp.input("/dev/stdin"))
+        run(lisp);
+    }
+    catch (int i) {
+      lisp.flush();
+      lisp.closein();
+      fflush(stdout);
+      fprintf(stderr, "ERR %d: %s\n", i, lisp.error(i));
+      return EXIT_FAILURE;
+    }
+    catch (MySmallLisp::QUIT) {
+    }
+    lisp.flush();
+    return EXIT_SUCCESS;
   }
+  printf("lisp");
+  lisp.input(init);
+  using_history();
+  GETSIGINT(lisp);              // when compiling with -DHAVE_SIGNAL_H CTRL-C breaks the evaluation
   while (1) {
     putchar('\n');
     lisp.unwind();
     lisp.prompt("%u+%u>");
     try {
       lisp.print(lisp.eval(*lisp.push(lisp.read()), lisp.env));
+      lisp.flush();
     }
     catch (int i) {
+      lisp.flush();
       lisp.closein();
       printf("ERR %d: %s", i, lisp.error(i));
     }
     catch (MySmallLisp::QUIT) {
+      lisp.flush();
       printf("Bye!\n");
       break;
     }
@@ -0,0 +1,88 @@
+// lisp-trace.cpp decodes the binary event traces recorded by lisp.hpp with (trace-record n) and record(n)
+// c++ -std=c++17 -o lisp-trace lisp-trace.cpp -O2
+// Usage: lisp-trace file.trace
+// prints one event per line with its time in microseconds, closure and macro calls indented by their depth
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static FILE *in;
+
+// error routine
+static void bad(const char *what) {
+  fprintf(stderr, "lisp-trace: %s\n", what);
+  exit(EXIT_FAILURE);
+}
+
+// read n bytes to p
+static void get(void *p, size_t n) {
+  if (fread(p, 1, n, in) != n)
+    bad("unexpected end of trace");
+}
+
+static uint32_t get32() {
+  uint32_t u;
+  get(&u, sizeof(u));
+  return u;
+}
+
+static uint64_t get64() {
+  uint64_t u;
+  get(&u, sizeof(u));
+  return u;
+}
+
+// read a table of strings
+static std::vector<std::string> table() {
+  std::vector<std::string> v(get32());
+  for (auto& s : v) {
+    s.resize(get32());
+    get(&s[0], s.size());
+  }
+  return v;
+}
+
+// return the string numbered i in table v
+static const char *name(const std::vector<std::string>& v, uint32_t i) {
+  return i < v.size() ? v[i].c_str() : "?";
+}
+
+int main(int argc, char **argv) {
+  char magic[8];
+  if (argc != 2) {
+    fprintf(stderr, "Usage: lisp-trace file.trace\n");
+    return EXIT_FAILURE;
+  }
+  if (!(in = fopen(argv[1], "rb")))
+    bad("cannot read trace");
+  get(magic, sizeof(magic));
+  if (std::string(magic, sizeof(magic)) != "LISPTRC1")
+    bad("not a trace");
+  auto names = table();
+  auto prims = table();
+  auto errors = table();
+  uint64_t n = get64(), dropped = get64();
+  if (dropped)
+    printf("(%llu earlier events dropped)\n", static_cast<unsigned long long>(dropped));
+  int depth = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    uint64_t t = get64();
+    uint32_t k = get32(), a = get32();
+    if (k == 2 && depth > 0)
+      --depth;
+    printf("%12.3f  %*s", t/1e3, 2*depth, "");
+    switch (k) {
+      case 1: printf("%s\n", name(names, a)); ++depth; break;
+      case 2: printf("%s returns\n", name(names, a)); break;
+      case 3: printf("(%s)\n", name(prims, a)); break;
+      case 4: printf("GC with %u heap bytes\n", a); break;
+      case 5: printf("GC done %u free cells\n", a); break;
+      case 6: printf("ERR %u: %s\n", a, name(errors, a)); break;
+      default: printf("event %u %u\n", k, a);
+    }
+  }
+  fclose(in);
+}
@@ -8,8 +8,30 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdint>
-#include <csetjmp>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/mman.h>   /* to reserve the cells and grow the stack */
+#include <sys/stat.h>   /* to check the cached form of loaded files */
+#include <pthread.h>    /* to find the C stack of the thread */
+#include <ucontext.h>   /* to switch between Lisp processes */
+#include <unistd.h>
 
 #ifdef HAVE_SIGNAL_H
 #include <signal.h>             /* to catch CTRL-C and continue the REPL */
@@ -22,9 +44,6 @@
 inline void using_history() { }
 #endif
 
-/* floating point output format */
-#define FLOAT "%.17lg"
-
 /* DEBUG: always run GC when allocating cells and atoms/strings on the heap */
 #ifdef DEBUG
 #define ALWAYS_GC 1
@@ -32,11 +51,40 @@ inline void using_history() { }
 #define ALWAYS_GC 0
 #endif
 
+/* STATS: count garbage collections and track the peak stack depth, reported to stderr by (quit) */
+#ifdef STATS
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
+
+/* HAVE_SYS_SDT_H: USDT probes lisp:gc__begin, lisp:gc__end, lisp:enter, lisp:leave, lisp:prim and lisp:error that
+   perf and bpftrace can attach to, they cost a nop each when not in use */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(lisp, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(lisp, name, a, b)
+#else
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#endif
+
 /* T(x) returns the tag bits of a NaN-boxed Lisp expression x */
 #define T(x) (*(uint64_t*)&x >> 48)
 
-/* Lisp class<P,S> parameterized with pool size P and stack/heap size S */
-template<uint32_t P,uint32_t S> class Lisp {
+/* the default instrumentation hooks of class Lisp<P,S,Hooks> do nothing and are optimized away, derive Hooks from
+   LispHooks to define the hooks to call, e.g. to feed metrics to a monitoring system */
+struct LispHooks {
+  void gc_begin(uint32_t, uint32_t) { }         /* GC begins with the heap bytes and the stack cells in use */
+  void gc_end(uint32_t, uint32_t) { }           /* GC ends with the free cells in the pool and the heap bytes in use */
+  template<class Lisp> void enter(Lisp&, double) { } /* closure or macro f of lisp is applied, see lisp.named(f) */
+  template<class Lisp> void leave(Lisp&, double) { } /* the closure or macro returns, unless an error is raised */
+  void prim(const char*) { }                    /* a primitive is called */
+  void error(int) { }                           /* an error is raised */
+};
+
+/* Lisp class<P,S,Hooks,D> parameterized with pool size P, heap size S, instrumentation Hooks and maximum stack depth D */
+template<uint32_t P,uint32_t S,class Hooks = LispHooks,uint32_t D = 1 << 22> class Lisp {
 
 /*----------------------------------------------------------------------------*\
  |      LISP EXPRESSION TYPES AND NAN BOXING                                  |
@@ -44,15 +92,34 @@ template<uint32_t P,uint32_t S> class Lisp {
 
 public:
 
-typedef Lisp<P,S> This;
+typedef Lisp This;
 
-Lisp<P,S>() {
+Lisp() {
+  cell = static_cast<L*>(mmap(NULL, sizeof(L)*N, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0));
+  if (cell == MAP_FAILED || mprotect(cell, E, PROT_READ|PROT_WRITE))
+    throw std::bad_alloc();                     /* reserve the cells, the pool and heap are accessible */
+  I g = sysconf(_SC_PAGESIZE)/sizeof(L);        /* cells per page */
+  sg = (E/sizeof(L)+g-1)/g*g+g;                 /* the stack bottom, the guard page below it stays inaccessible */
+  sl = sp = N;                                  /* no stack space accessible yet */
+  grow(std::min<I>(g, N-sg));                   /* make the top page of the stack accessible */
   A = reinterpret_cast<char*>(cell);
   fp = 0;                                       /* free pointer */
   hp = H;                                       /* heap pointer */
   sp = N;                                       /* stack pointer */
   tr = 0;                                       /* 0 when tracing is off, 1 or 2 to trace Lisp evaluation steps */
+  gcs = 0;                                      /* no garbage collections yet */
+  ms = N;                                       /* the lowest stack pointer */
   out = stdout;                                 /* the file we are writing to, stdout by default */
+  of = stdout;                                  /* the file the output buffer is flushed to */
+  on = 0;                                       /* the output buffer is empty */
+  fuel = conses = bytes = ~0ULL;                /* no evaluation limits */
+  due = std::chrono::steady_clock::time_point::max(); /* no deadline */
+  tk = 1;
+  pf = 0;                                       /* not profiling */
+  ap = 0;
+  cn = 0;                                       /* no catch forms evaluated */
+  prof = NULL;
+  pool = NULL;                                  /* no worker pool yet, before gc() may run */
   memset(used, 0, sizeof(used));                /* clear the 'used' bit vector */
   sweep();                                      /* clear the pool */
   nil = box(NIL, 0);                            /* set the constant nil (empty list) */
@@ -61,16 +128,35 @@ Lisp<P,S>() {
   for (I i = 0; prim[i].s; ++i)                 /* expand environment with primitives */
     env = pair(atom(prim[i].s), box(PRIM, i), env);
   fin = 0;                                      /* no open files */
+  fb = 0;                                       /* read files in[fb..fin-1] before memory or the terminal */
+  batch = 0;                                    /* read the terminal after the input files */
+  mp = me = NULL;                               /* not reading from memory */
   see = '\n';                                   /* input line sentinel \n */
+  buf = NULL;                                   /* no tokenization buffer yet */
+  bn = 0;
   ptr = "";                                     /* pointer to char in line, init to \0 end of line */
   line = NULL;                                  /* no line read */
   strcpy(ps, ">");                              /* prompt */
-  break_on();                                   /* enable interrupt if compiled with -DHAVE_SIGINT_H */
+  irq = 0;                                      /* no interrupt requested */
+  workers = std::thread::hardware_concurrency(); /* pmap and preduce use a worker interpreter per core */
+  cur = 0;                                      /* the main process runs, no other processes yet */
+  dl = 0;                                       /* no deadlock */
 }
 
-~Lisp<P,S>() {
+~Lisp() {
+  stop();                                       /* stop the worker pool */
+  sample(0);                                    /* stop the sampling timer */
+  delete prof;                                  /* delete the profile */
+  for (auto q : pr) {                           /* delete the processes */
+    if (q->stack)
+      munmap(q->stack-sysconf(_SC_PAGESIZE), sysconf(_SC_PAGESIZE)+Z);
+    delete q;
+  }
   break_default();                              /* reinstate CTRL-C default if compiled with -DHAVE_SIGINT_H */
+  flush();                                      /* flush the output buffer */
   closein();                                    /* close all open input files */
+  free(buf);                                    /* free the tokenization buffer */
+  munmap(cell, sizeof(L)*N);                    /* release the cells */
 }
 
 /* we only need two types to implement a Lisp interpreter:
@@ -92,8 +178,9 @@ typedef double L;
 
 protected:
 
-/* primitive, atom, string, cons, closure, macro and nil tags for NaN boxing (reserve 0x7ff8 for nan) */
-static const I PRIM = 0x7ff9, ATOM = 0x7ffa, STRG = 0x7ffb, CONS = 0x7ffc, CLOS = 0x7ffe, MACR = 0x7fff, NIL = 0xffff;
+/* primitive, atom, string, cons, future, closure, macro, promise and nil tags for NaN boxing (reserve 0x7ff8 for nan) */
+static const I PRIM = 0x7ff9, ATOM = 0x7ffa, STRG = 0x7ffb, CONS = 0x7ffc, FUTR = 0x7ffd, CLOS = 0x7ffe, MACR = 0x7fff,
+               PROM = 0xfff9, NIL = 0xffff;
 
 /* box(t,i): returns a new NaN-boxed double with tag t and ordinal i
    ord(x):   returns the ordinal of the NaN-boxed double x
@@ -124,8 +211,8 @@ static I equ(L x, L y) {
 public:
 
 /* report and throw an exception */
-#define ERR(n, ...) (fprintf(stderr, __VA_ARGS__), err(n))
-static L err(int n) { throw n; }
+#define ERR(n, ...) (flush(), fprintf(stderr, __VA_ARGS__), err(n))
+L err(int n) { if (pf & 8) fault(n); hooks.error(n); PROBE1(error, n); throw n; }
 
 /* return error string for error code or empty string */
 static const char *error(int i) {
@@ -138,25 +225,36 @@ static const char *error(int i) {
     case 6: return "stack over";
     case 7: return "out of memory";
     case 8: return "syntax";
+    case 9: return "deadlock";
+    case 10: return "out of fuel";
+    case 11: return "cons limit";
+    case 12: return "heap limit";
+    case 13: return "deadline";
     default: return "";
   }
 }
 
+/* request a break of the evaluation in this instance, e.g. from another thread or a signal handler, raises err(2) at
+   the next closure call or loop iteration */
+void interrupt() {
+  irq.fetch_or(1, std::memory_order_relaxed);
+}
+
 #ifdef HAVE_SIGNAL_H
 
-#define GETSIGINT(obj) setjmp((obj).jb);
-static inline jmp_buf jb;
-static void sigint(int i) { longjmp(jb, i); }                    /* cannot throw in sig handlers */
-static void break_on() { signal(SIGINT, This::sigint); }
-static void break_off() { signal(SIGINT, SIG_IGN); }
-static void break_default() { signal(SIGINT, SIG_DFL); }
+/* CTRL-C breaks the evaluation in the instance that called GETSIGINT(obj) last, usually the REPL on the main thread,
+   the signal handler only sets the interrupt flag that is polled at safe points */
+#define GETSIGINT(obj) (obj).break_here()
+static_assert(std::atomic<I>::is_always_lock_free, "the interrupt flag must be async-signal-safe");
+static inline This *volatile brk = NULL;
+static void sigint(int) { if (brk) brk->interrupt(); }
+void break_here() { brk = this; signal(SIGINT, This::sigint); }
+void break_default() { if (brk == this) signal(SIGINT, SIG_DFL), brk = NULL; }
 
 #else
 
-#define GETSIGINT(obj) 0
-static void break_on() { }
-static void break_off() { }
-static void break_default() { }
+#define GETSIGINT(obj) (void)(obj)
+void break_default() { }
 
 #endif
 
@@ -172,33 +270,90 @@ char *A;
 /* Lisp constant expressions () (nil) and #t, and the global environment env */
 L nil, tru, env;
 
+/* evaluation limits, unlimited by default, the host may set them to limit the evaluation in this instance:
+   fuel:   the number of closure and macro applications and loop iterations, err(10) when used up
+   conses: the number of pairs to construct, err(11) when used up
+   bytes:  the number of atom/string heap bytes to allocate, err(12) when used up */
+uint64_t fuel, conses, bytes;
+
 /* garbage collector, returns number of free cells in the pool or raises err(7) */
 I gc() {
   I i;
-  break_off();                                  /* do not interrupt GC if compiled with -DHAVE_SIGINT_H */
+  STAT(++gcs);
+  if (pf & 8)
+    event(4, hp-H);                             /* GC starts, the heap bytes in use */
+  hooks.gc_begin(hp-H, N-sp);
+  PROBE2(gc__begin, hp-H, N-sp);
   memset(used, 0, sizeof(used));                /* clear all used[] bits */
   if (T(env) == CONS)
     mark(ord(env));                             /* mark all globally-used cons cell pairs referenced from env list */
   for (i = sp; i < N; ++i)
-    if ((T(cell[i]) & ~(CONS^MACR)) == CONS)
+    if (pairs(cell[i]))
       mark(ord(cell[i]));                       /* mark all cons cell pairs referenced from the stack */
+  for (auto q : pr)
+    mark(q->rec);                               /* mark the saved stacks, thunks and channels of processes */
+  if (pool && pool->owner == this)
+    prune();                                    /* release the futures whose pairs are no longer used */
+  if (prof)
+    prof->kc.clear();                           /* the pairs of profiled closures may be recycled */
   i = sweep();                                  /* remove unused cons cell pairs from the pool */
   compact();                                    /* remove unused atoms and strings from the heap */
-  break_on();                                   /* enable interrupt if compiled with -DHAVE_SIGINT_H */
+  if (pf & 8)
+    event(5, i);                                /* GC ends, the free cells in the pool */
+  hooks.gc_end(i, hp-H);
+  PROBE2(gc__end, i, hp-H);
   return i ? i : err(7);
 }
 
 /* push x on the stack to protect it from being recycled, returns pointer to cell pair (e.g. to update the value) */
 L *push(L x) {
+  if (sp <= sl)                                 /* no accessible stack space left, grow the stack */
+    grow(1);
   cell[--sp] = x;                               /* we must save x on the stack so it won't get GC'ed */
-  if (hp > (sp-1) << 3 || ALWAYS_GC) {          /* if insufficient stack space is available, then GC */
-    gc();                                       /* GC */
-    if (hp > (sp-1) << 3)                       /* GC did not free up heap space to enlarge the stack */
-      err(6);
-  }
+  STAT(if (sp < ms) ms = sp);                   /* track the peak stack depth */
+  if (ALWAYS_GC)
+    gc();
   return &cell[sp];
 }
 
+/* reserve n cells on the stack to store without push() */
+void room(I n) {
+  if (sp < sl+n)                                /* insufficient accessible stack space, grow the stack */
+    grow(n);
+  if (ALWAYS_GC)
+    gc();
+}
+
+/* make the stack accessible below sp-n, at least doubling the accessible stack space, or raise err(6) */
+void grow(I n) {
+  I g = sysconf(_SC_PAGESIZE)/sizeof(L);        /* cells per page */
+  if (sp < sg+n)                                /* the stack would overrun the guard page */
+    err(6);
+  I k = N-sl < sl-sg ? sl-(N-sl) : sg;
+  k = std::min(k, sp-n)/g*g;                    /* the new page-aligned lowest accessible stack cell */
+  if (mprotect(cell+k, sizeof(L)*(sl-k), PROT_READ|PROT_WRITE))
+    err(6);
+  sl = k;
+}
+
+/* raise err(6) when less than 64K of the C stack of the running process or thread is left, before C recursion */
+void deep() {
+  static thread_local char *lo = NULL;          /* the lowest address of the C stack of the thread */
+  char *b = cur ? pr[cur]->stack : lo, c;
+  if (!b) {
+    pthread_attr_t a;
+    void *p = NULL;
+    size_t n;
+    if (!pthread_getattr_np(pthread_self(), &a)) {
+      pthread_attr_getstack(&a, &p, &n);
+      pthread_attr_destroy(&a);
+    }
+    b = lo = static_cast<char*>(p);
+  }
+  if (reinterpret_cast<uintptr_t>(&c) < reinterpret_cast<uintptr_t>(b)+65536)
+    err(6);
+}
+
 /* pop from the stack and return value */
 L pop() {
   return cell[sp++];
@@ -211,34 +366,97 @@ void unwind(I i = N) {
 
 protected:
 
-/* total number of cells to allocate = P+S */
-static const uint32_t N = P+S;
+/* cells reserved between the heap and the stack for the guard page, for pages up to 64K */
+static const uint32_t G = 16384;
+
+/* total number of cells to reserve = P+S+G+D, the stack starts at the top and grows down to the guard page */
+static const uint32_t N = P+S+G+D;
 
 /* heap address start offset, the heap starts at address A+H immediately above the pool */
 static const uint32_t H = sizeof(L)*P;
 
+/* heap address end offset, the heap ends at address A+E below the guard page */
+static const uint32_t E = sizeof(L)*(P+S);
+
 /* size of the cell reference field of an atom/string on the heap, used by the compacting garbage collector */
 static const uint32_t R = sizeof(I);
 
-/* array of Lisp expressions, shared by the pool, heap and stack */
-L cell[N];
+/* array of Lisp expressions, shared by the pool, heap and stack, only the pool, heap and cell[sl..N-1] are accessible */
+L *cell;
+
+/* sl: the lowest accessible stack cell, the stack grows by making the pages below it accessible
+   sg: the lowest stack cell above the guard page, the stack cannot grow below it */
+I sl, sg;
 
-/* fp: free pointer points to free cell pair in the pool, next free pair is ord(cell[fp]) unless fp=0
-   hp: heap pointer, A+hp points free atom/string heap space above the pool and below the stack
+/* fp: free pointer points to free cell pair in the pool, next free pair is ord(cell[fp]) unless fp=0, pair 0 is never
+       free so that fp=0 means no free pairs are left
+   hp: heap pointer, A+hp points free atom/string heap space above the pool and below A+E
    sp: stack pointer, the stack starts at the top of cell[] with sp=N
    tr: 0 when tracing is off, 1 or 2 to trace Lisp evaluation steps */
 I fp, hp, sp, tr;
 
+/* the number of catch forms and futures being evaluated, an error raised in them is caught */
+I cn;
+
+/* bit 0 set when an interrupt is requested with interrupt(), bit 1 set when the sampling timer requests a sample */
+std::atomic<I> irq;
+
+/* raise err(2) when an interrupt was requested, called at safe points in step() and loops that also use fuel */
+void poll() {
+  if (!fuel)                                    /* out of fuel, stays out of fuel until the host adds fuel */
+    err(10);
+  --fuel;
+  if (irq.load(std::memory_order_relaxed)) {
+    I r = irq.exchange(0);
+    if ((r & 2) && (pf & 2))                    /* the sampling timer requests a sample */
+      hit();
+    if (r & 1)
+      err(2);
+  }
+  if (!--tk)                                    /* check the deadline every 1024 safe points */
+    tick();
+}
+
+/* wait on c with lock l held for up to 10ms or until the deadline, returns 2 when an interrupt was requested, 13 when
+   the deadline passed or 0 otherwise, the caller loops until its condition holds */
+int pause(std::unique_lock<std::mutex>& l, std::condition_variable& c) {
+  c.wait_until(l, std::min(due, std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+  if (irq.fetch_and(~1U) & 1)
+    return 2;
+  if (due != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= due)
+    return 13;
+  return 0;
+}
+
+/* the deadline of the evaluation and the countdown of safe points to check it */
+std::chrono::steady_clock::time_point due;
+I tk;
+
+/* raise err(13) when the deadline passed */
+void tick() {
+  tk = 1024;
+  if (due != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= due)
+    err(13);
+}
+
+/* the number of garbage collections and the lowest stack pointer, when compiled with -DSTATS */
+I gcs, ms;
+
 /* bit vector corresponding to the pairs of cells in the pool marked 'used' (car and cdr cells are marked together) */
 uint32_t used[(P+63)/64];
 
+/* return nonzero if x refers to a pair in the pool, i.e. x is a cons, future, closure, macro or promise */
+static I pairs(L x) {
+  return (T(x) & ~(CONS^MACR)) == CONS || T(x) == PROM;
+}
+
 /* mark-sweep garbage collector recycles cons pair pool cells, finds and marks cells that are used */
 void mark(I i) {
   while (!(used[i/64] & 1 << i/2%32)) {         /* while i'th cell pair is not used in the pool */
     used[i/64] |= 1 << i/2%32;                  /* mark i'th cell pair as used */
-    if ((T(cell[i]) & ~(CONS^MACR)) == CONS)    /* recursively mark car cell[i] if car refers to a pair */
+    if (pairs(cell[i]))                         /* recursively mark car cell[i] if car refers to a pair */
       mark(ord(cell[i]));
-    if ((T(cell[i+1]) & ~(CONS^MACR)) != CONS)  /* if cdr cell[i+1] is not a pair, then break and return */
+    if (!pairs(cell[i+1]))                      /* if cdr cell[i+1] is not a pair, then break and return */
       break;
     i = ord(cell[i+1]);                         /* iteratively mark cdr cell[i+1] */
   }
@@ -247,7 +465,7 @@ void mark(I i) {
 /* mark-sweep garbage collector recycles cons pair pool cells, returns total number of free cells in the pool */
 I sweep() {
   I i, j;
-  for (fp = 0, i = P/2, j = 0; i--; ) {         /* for each cons pair (two cells) in the pool, from top to bottom */
+  for (fp = 0, i = P/2, j = 0; --i; ) {         /* for each cons pair (two cells) in the pool above pair 0, from top */
     if (!(used[i/32] & 1 << i%32)) {            /* if the cons pair cell[2*i] and cell[2*i+1] are not used */
       cell[2*i] = box(NIL, fp);                 /* then add it to the linked list of free cells pairs as a NIL box */
       fp = 2*i;                                 /* free pointer points to the last added free pair */
@@ -266,16 +484,21 @@ void link(I i) {
 
 /* compacting garbage collector recycles heap by removing unused atoms/strings and by moving used ones */
 void compact() {
-  I i, j;
-  for (i = H; i < hp; i += strlen(A+R+i)+R+1)   /* reset all atom/string reference fields to N (end of linked list) */
+  I i, j, m;
+  if (pf & 4)
+    prof->hs.clear();
+  for (i = H; i < hp; i += strlen(A+R+i)+R+1) { /* reset all atom/string reference fields to N (end of linked list) */
+    if (pf & 4)
+      prof->hs.push_back(*(I*)(A+i));           /* save the allocation site kept in the reference field */
     *(I*)(A+i) = N;
+  }
   for (i = 0; i < P; ++i)                       /* add each used atom/string cell in the pool to its linked list */
     if (used[i/64] & 1 << i/2%32 && (T(cell[i]) & ~(ATOM^STRG)) == ATOM)
       link(i);
   for (i = sp; i < N; ++i)                      /* add each used atom/string cell on the stack to its linked list */
     if ((T(cell[i]) & ~(ATOM^STRG)) == ATOM)
       link(i);
-  for (i = H, j = hp, hp = H; i < j; ) {        /* for each atom/string on the heap */
+  for (i = H, j = hp, hp = H, m = 0; i < j; ++m) { /* for each atom/string on the heap */
     I k = *(I*)(A+i), n = strlen(A+R+i)+R+1;
     if (k < N) {                                /* if its linked list is not empty, then we need to keep it */
       while (k < N) {                           /* traverse linked list to update atom/string cells to hp+R */
@@ -285,6 +508,8 @@ void compact() {
       }
       if (hp < i)
         memmove(A+hp, A+i, n);                  /* move atom/string further down the heap to hp+R to compact the heap */
+      if (pf & 4)
+        *(I*)(A+hp) = prof->hs[m];              /* restore the allocation site */
       hp += n;                                  /* update heap pointer to the available space above the atom/string */
     }
     i += n;
@@ -301,13 +526,18 @@ public:
 I alloc(I n) {
   I i = hp+R;                                   /* free atom/heap is located at hp+R */
   n += R+1;                                     /* n+R+1 is the space we need to reserve */
-  if (hp+n > (sp-1) << 3 || ALWAYS_GC) {        /* if insufficient heap space is available, then GC */
+  if (n > bytes)                                /* heap limit */
+    bytes = 0, err(12);
+  bytes -= n;
+  if (hp+n > E || ALWAYS_GC) {                  /* if insufficient heap space is available, then GC */
     gc();                                       /* GC */
-    if (hp+n > (sp-1) << 3)                     /* GC did not free up sufficient heap/stack space */
-      err(6);
+    if (hp+n > E)                               /* GC did not free up sufficient heap space */
+      err(7);
     i = hp+R;                                   /* new atom/string is located at hp+R on the heap */
   }
   hp += n;                                      /* update heap pointer to the available space above the atom/string */
+  if (pf & 4)
+    site(i, n);
   return i;
 }
 
@@ -333,11 +563,23 @@ L string(const char *s) {
 
 /* construct pair (x . y) returns a NaN-boxed CONS */
 L cons(L x, L y) {
-  L p; I i = fp;                                /* i'th cons cell pair car cell[i] and cdr cell[i+1] is free */
+  L p; I i;
+  if (!conses)                                  /* cons limit */
+    err(11);
+  if (!fp) {                                    /* no free cell pairs left after a GC raised err(7), GC again */
+    push(x);
+    push(y);
+    gc();
+    unwind(sp+2);
+  }
+  --conses;
+  i = fp;                                       /* i'th cons cell pair car cell[i] and cdr cell[i+1] is free */
   fp = ord(cell[i]);                            /* update free pointer to next free cell pair, zero if none are free */
   cell[i] = x;                                  /* save x into car cell[i] */
   cell[i+1] = y;                                /* save y into cdr cell[i+1] */
   p = box(CONS, i);                             /* new cons pair NaN-boxed CONS */
+  if (pf & 4)
+    site(i, 0);
   if (!fp || ALWAYS_GC) {                       /* if no more free cell pairs */
     push(p);                                    /* save new cons pair p on the stack so it won't get GC'ed */
     gc();                                       /* GC */
@@ -380,6 +622,13 @@ L assoc(L v, L e) {
   return T(e) == CONS ? cdr(car(e)) : T(v) == ATOM ? ERR(3, "unbound %s ", A+ord(v)) : err(3);
 }
 
+/* change the value of a symbol in an environment, returns the value */
+L assign(L v, L x, L e) {
+  while (T(e) == CONS && !equ(v, car(car(e))))
+    e = cdr(e);
+  return T(e) == CONS ? CDR(car(e)) = x : T(v) == ATOM ? ERR(3, "unbound %s ", A+ord(v)) : err(3);
+}
+
 /* Not(x) is nonzero if x is the Lisp () empty list */
 I Not(L x) {
   return T(x) == NIL;
@@ -407,26 +656,155 @@ void closein() {
     fclose(in[--fin]);
 }
 
+/* skip white space and ;-comments in the input files, returns nonzero when all input files are read */
+I eof() {
+  while (fin > fb && (seeing(' ') || seeing(';')))
+    if (get() == ';')
+      while (fin > fb && !seeing('\n'))        /* skip ;-comment until newline */
+        get();
+  return fin <= fb;
+}
+
+/* batch mode is nonzero to read the input files without prompts, the input ends at the end of the files */
+I batch;
+
 /* return the Lisp expression parsed and read from input */
 L read() {
   scan();
   return parse();
 }
 
-/* specify a REPL prompt, where the first %u shows free pool space and second %u shows free stack/heap space */
+/* return the first Lisp expression parsed and read straight from caller memory s without copying */
+L read_string(std::string_view s) {
+  L x;
+  const char *p = mp, *q = me; char c = see; I f = fb;
+  mp = s.data();                                /* read from memory s */
+  me = mp+s.size();
+  see = ' ';
+  fb = fin;                                     /* hide the input files that are still open */
+  try {
+    x = read();
+  }
+  catch (...) {
+    while (fin > fb)                            /* close the files opened while reading from memory */
+      fclose(in[--fin]);
+    mp = p, me = q, see = c, fb = f;
+    throw;
+  }
+  mp = p, me = q, see = c, fb = f;
+  return x;
+}
+
+/* evaluate all Lisp expressions in s read straight from caller memory in the global environment, returns last value */
+L eval_string(std::string_view s) {
+  L x = nil;
+  const char *p = mp, *q = me; char c = see; I f = fb, k = sp;
+  mp = s.data();                                /* read from memory s */
+  me = mp+s.size();
+  see = ' ';
+  fb = fin;                                     /* hide the input files that are still open */
+  try {
+    while (1) {
+      if (eof() && blank())                     /* stop when all files loaded by s are read and the rest is blank */
+        break;
+      unwind(k);
+      x = eval(*push(read()), env);
+    }
+  }
+  catch (...) {
+    while (fin > fb)                            /* close the files opened by s */
+      fclose(in[--fin]);
+    mp = p, me = q, see = c, fb = f;
+    unwind(k);
+    throw;
+  }
+  mp = p, me = q, see = c, fb = f;
+  unwind(k);
+  return x;
+}
+
+/* load and evaluate the Lisp expressions in file s in the global environment, returns last value.  The parsed
+   expressions are cached in serialized form in file s.fasl, which is used instead of s when the path, size,
+   modification time, inode and content hash of s match the cache header.  Otherwise s is parsed and the cache is
+   updated if its directory is writable */
+L load(const char *s) {
+  std::string f(s), k, d;
+  struct stat st;
+  L x = nil, y, *p;
+  I i = sp;
+  if (stat(s, &st))
+    ERR(5, "cannot read %s ", s);
+  k = ";fasl " + std::to_string(st.st_size) + " " + std::to_string(st.st_mtim.tv_sec) + "." +
+      std::to_string(st.st_mtim.tv_nsec) + " " + std::to_string(st.st_ino) + " " + std::to_string(digest(s)) + " " + f + "\n";
+  if (FILE *fd = fopen((f + ".fasl").c_str(), "rb")) { /* read the cache */
+    char b[4096];
+    size_t n;
+    while ((n = fread(b, 1, sizeof(b), fd)) > 0)
+      d.append(b, n);
+    fclose(fd);
+  }
+  if (d.size() > k.size() && !d.compare(0, k.size(), k)) {
+    try {
+      x = deserialize(std::string_view(d).substr(k.size()));
+    }
+    catch (int n) {                             /* the cache is corrupt, parse s */
+      if (n != 8)
+        throw;
+      d.clear();
+    }
+  }
+  else
+    d.clear();
+  p = push(x);
+  if (d.empty()) {
+    *p = parsefile(f.c_str());
+    d = k + serialize(*p, 0);
+    k = f + ".fasl." + std::to_string(getpid()) + "." + std::to_string(reinterpret_cast<uintptr_t>(this));
+    if (FILE *fd = fopen(k.c_str(), "wb")) {    /* write the cache to a temporary file and then rename it */
+      if (fwrite(d.data(), 1, d.size(), fd) == d.size() && !fclose(fd))
+        rename(k.c_str(), (f + ".fasl").c_str());
+      else
+        remove(k.c_str());
+    }
+  }
+  for (x = nil, y = *p; T(y) == CONS; y = *p = cdr(y)) /* evaluate the expressions, the rest of the list is protected */
+    x = eval(car(y), env);
+  unwind(i);
+  return x;
+}
+
+/* specify a REPL prompt, where the first %u shows free pool space and second %u shows free heap space */
 void prompt(const char *s) {
   I i = gc();
-  snprintf(ps, sizeof(ps), s, i, sp-hp/8);
+  snprintf(ps, sizeof(ps), s, i, (E-hp)/8);
 }
 
 protected:
 
-/* the file(s) we are reading or fin=0 when reading from the terminal */
-I fin;
+/* FNV-1a hash of the contents of file s, detects changes to s within the resolution of its modification time */
+static uint64_t digest(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+  if (FILE *fd = fopen(s, "rb")) {
+    char b[4096];
+    size_t n;
+    while ((n = fread(b, 1, sizeof(b), fd)) > 0)
+      for (size_t i = 0; i < n; ++i)
+        h = (h ^ static_cast<unsigned char>(b[i]))*1099511628211ULL;
+    fclose(fd);
+  }
+  return h;
+}
+
+/* the file(s) we are reading or fin=fb when reading from memory or the terminal */
+I fin, fb;
 FILE *in[10];
 
-/* tokenization buffer and the next character that we see */
-char buf[256], see;
+/* memory [mp,me) we are reading with read_string() and eval_string(), mp=NULL past the end, me=NULL when not used */
+const char *mp, *me;
+
+/* tokenization buffer buf[] of bn bytes that grows as needed, and the next character that we see */
+char *buf, see;
+I bn;
 
 /* readline pointer into the last line */
 const char *ptr, *line;
@@ -434,26 +812,70 @@ const char *ptr, *line;
 /* prompt string */
 char ps[20];
 
+/* return the list of Lisp expressions parsed and read from file s */
+L parsefile(const char *s) {
+  const char *q = mp, *r = me; char c = see; I f = fb;
+  L *p = push(nil), *t = p;
+  if (!input(s))
+    ERR(5, "cannot read %s ", s);
+  mp = me = "";                                 /* hide memory and the terminal, so the end of s ends the expression */
+  see = ' ';
+  fb = fin-1;                                   /* hide the input files that are still open */
+  try {
+    while (1) {
+      while (fin > fb && (seeing(' ') || seeing(';')))  /* skip white space and ;-comments */
+        if (get() == ';')
+          while (fin > fb && !seeing('\n'))
+            get();
+      if (fin <= fb)
+        break;
+      *t = cons(read(), nil);                   /* add the expression to the end of the list by replacing the last nil */
+      t = &CDR(*t);
+    }
+  }
+  catch (...) {
+    while (fin > fb)
+      fclose(in[--fin]);
+    mp = q, me = r, see = c, fb = f;
+    throw;
+  }
+  mp = q, me = r, see = c, fb = f;
+  return pop();
+}
+
 /* return the character we see, advance to the next character */
 char get() {
   int c, look = see;
-  if (fin) {                                    /* if reading from a file */
+  if (fin > fb) {                               /* if reading from a file */
     see = c = getc(in[fin-1]);                  /* read a character */
     if (c == EOF) {
       fclose(in[--fin]);                        /* if end of file, then close the file */
       see = '\n';                               /* pretend we see a newline at eof */
     }
   }
+  else if (me) {                                /* if reading from memory */
+    if (!mp)                                    /* error if reading past the end */
+      ERR(8, "unexpected end ");
+    if (mp < me)
+      see = *mp++;                              /* read a character */
+    else {
+      see = '\n';                               /* pretend we see a newline at the end */
+      mp = NULL;
+    }
+  }
+  else if (batch)                               /* in batch mode there is no input after the input files */
+    ERR(8, "unexpected end ");
   else {
+    if (see == '\n')
+      flush();                                  /* flush the output before reading a new line from the terminal */
 #ifdef HAVE_READLINE_H
     if (see == '\n') {                          /* if looking at the end of the current readline line */
-      break_off();                              /* disable interrupt to prevent free() without final line = NULL */
       if (line)                                 /* free the old line that was malloc'ed by readline */
         free(const_cast<char*>(line));
       line = NULL;
-      break_on();                               /* enable interrupt if compiled with -DHAVE_SIGINT_H */
       while (!(ptr = line = readline(ps)))      /* read new line and set ptr to start of the line */
         freopen("/dev/tty", "r", stdin);        /* try again when line is NULL after EOF by CTRL-D */
+      irq = 0;                                  /* ignore CTRL-C while waiting for input */
       add_history(line);                        /* make it part of the history */
       strcpy(ps, "?");                          /* change prompt to ? */
     }
@@ -468,6 +890,7 @@ char get() {
       freopen("/dev/tty", "r", stdin);
       c = '\n';
     }
+    irq = 0;                                    /* ignore CTRL-C while waiting for input */
     see = c;
 #endif
   }
@@ -479,6 +902,35 @@ I seeing(char c) {
   return c == ' ' ? see > 0 && see <= c : see == c;
 }
 
+/* return nonzero if the rest of the memory we are reading is blank, i.e. white space and ;-comments only */
+I blank() {
+  const char *s = mp;
+  char c = see;
+  while (1) {
+    if (c == ';')
+      while (s && s < me && *s != '\n')
+        ++s;
+    else if (c <= 0 || c > ' ')
+      return 0;
+    if (!s || s >= me)
+      return 1;
+    c = *s++;
+  }
+}
+
+/* add character c to the token in buf[] at position i, doubles the size of buf[] when full */
+void add(I i, char c) {
+  if (i+1 >= bn) {                              /* if buf[] is full, then double its size */
+    I n = bn ? 2*bn : 256;
+    char *b = static_cast<char*>(realloc(buf, n));
+    if (!b)
+      err(7);
+    buf = b;
+    bn = n;
+  }
+  buf[i] = c;
+}
+
 /* tokenize into buf[], return first character of buf[] */
 char scan() {
   I i = 0;
@@ -488,26 +940,26 @@ char scan() {
         get();
   if (seeing('"')) {                            /* tokenize a quoted string */
     do {
-      buf[i++] = get();
-      while (seeing('\\') && i < sizeof(buf)-1) {
+      add(i++, get());
+      while (seeing('\\')) {
         static const char *abtnvfr = "abtnvfr"; /* \a, \b, \t, \n, \v, \f, \r escape codes */
         const char *esc;
         get();
         esc = strchr(abtnvfr, see);
-        buf[i++] = esc ? esc-abtnvfr+7 : see;   /* replace \x with an escaped code or x itself */
+        add(i++, esc ? esc-abtnvfr+7 : see);    /* replace \x with an escaped code or x itself */
         get();
       }
     }
-    while (i < sizeof(buf)-1 && !seeing('"') && !seeing('\n'));
+    while (!seeing('"') && !seeing('\n'));
     if (get() != '"')
       ERR(8, "missing \" ");
   }
   else if (seeing('(') || seeing(')') || seeing('\''))
-    buf[i++] = get();                           /* ( ) ' are single-character tokens */
+    add(i++, get());                            /* ( ) ' are single-character tokens */
   else                                          /* tokenize a symbol or a number */
     do
-      buf[i++] = get();
-    while (i < sizeof(buf)-1 && !seeing('(') && !seeing(')') && !seeing(' '));
+      add(i++, get());
+    while (!seeing('(') && !seeing(')') && !seeing(' '));
   buf[i] = 0;
   return *buf;                                  /* return first character of token in buf[] */
 }
@@ -529,9 +981,26 @@ L list() {
   }
 }
 
+/* return nonzero if token s is a number and store its value in x, including inf, -inf and nan */
+static I number(const char *s, L *x) {
+  const char *t = s+(*s == '+' || *s == '-'), *e; /* t points to the token after the sign */
+  if ((*t < '0' || *t > '9') && *t != '.' && (*t|32) != 'i' && (*t|32) != 'n')
+    return 0;                                   /* quickly reject symbols by their first one or two characters */
+  e = t+strlen(t);
+  auto [p, ec] = std::from_chars(*s == '-' ? s : t, e, *x);
+  if (p == e && ec == std::errc())
+    return 1;
+  if ((p == e && ec == std::errc::result_out_of_range) || (*t == '0' && (t[1]|32) == 'x')) {
+    char *q;                                    /* let strtod() handle the rare overflow, underflow and hex */
+    *x = strtod(s, &q);
+    return !*q;
+  }
+  return 0;
+}
+
 /* return a parsed Lisp expression */
 L parse() {
-  L x; I i;
+  L x;
   if (*buf == '(')                              /* if token is ( then parse a list */
     return list();
   if (*buf == '\'') {                           /* if token is ' then parse an expression x to return (quote x) */
@@ -540,7 +1009,7 @@ L parse() {
   }
   if (*buf == '"')                              /* if token is a string, then return a new string */
     return string(buf+1);
-  if (sscanf(buf, "%lg%n", &x, &i) > 0 && !buf[i])
+  if (number(buf, &x))
     return x;                                   /* return a number, including inf, -inf and nan */
   if (*buf != ')')
     return atom(buf);                           /* return an atom (a symbol) */
@@ -567,7 +1036,7 @@ L evlis(L t, L e) {
 
 L f_type(L t, L *_) {
   L x = car(t);
-  return T(x) == NIL ? -1.0 : T(x) >= PRIM && T(x) <= MACR ? T(x) - PRIM + 1 : 0.0;
+  return T(x) == NIL ? -1.0 : T(x) == PROM ? 8.0 : T(x) >= PRIM && T(x) <= MACR ? T(x) - PRIM + 1 : 0.0;
 }
 
 L f_ident(L t, L *_) {
@@ -657,9 +1126,11 @@ L f_begin(L t, L *e) {
 
 L f_while(L t, L *e) {
   L s, x = nil;
-  while (!Not(eval(car(t), *e)))
+  while (!Not(eval(car(t), *e))) {
     for (s = cdr(t); T(s) != NIL; s = cdr(s))
       x = eval(car(s), *e);
+    poll();                                     /* a safe point to break when an interrupt was requested */
+  }
   return x;
 }
 
@@ -682,7 +1153,8 @@ L f_macro(L t, L *_) {
 }
 
 L f_define(L t, L *e) {
-  env = pair(car(t), eval(car(cdr(t)), *e), env);
+  L x = eval(car(cdr(t)), *e);
+  env = pair(car(t), x, env);
   return car(t);
 }
 
@@ -696,14 +1168,18 @@ L f_env(L _, L *e) {
 
 L f_let(L t, L *e) {
   L d = *e;
-  for (; more(t); t = cdr(t))
-    *e = pair(car(car(t)), eval(f_begin(cdr(car(t)), &d), d), *e);
+  for (; more(t); t = cdr(t)) {
+    L x = eval(f_begin(cdr(car(t)), &d), d);
+    *e = pair(car(car(t)), x, *e);
+  }
   return T(t) == NIL ? nil : car(t);
 }
 
 L f_leta(L t, L *e) {
-  for (; more(t); t = cdr(t))
-    *e = pair(car(car(t)), eval(f_begin(cdr(car(t)), e), *e), *e);
+  for (; more(t); t = cdr(t)) {
+    L x = eval(f_begin(cdr(car(t)), e), *e);
+    *e = pair(car(car(t)), x, *e);
+  }
   return T(t) == NIL ? nil : car(t);
 }
 
@@ -725,10 +1201,8 @@ L f_letreca(L t, L *e) {
 }
 
 L f_setq(L t, L *e) {
-  L x = eval(car(cdr(t)), *e), v = car(t), d = *e;
-  while (T(d) == CONS && !equ(v, car(car(d))))
-    d = cdr(d);
-  return T(d) == CONS ? CDR(car(d)) = x : T(v) == ATOM ? ERR(3, "unbound %s ", A+ord(v)) : err(3);
+  L x = eval(car(cdr(t)), *e);
+  return assign(car(t), x, *e);
 }
 
 L f_setcar(L t, L *_) {
@@ -758,7 +1232,7 @@ L f_print(L t, L *_) {
 
 L f_println(L t, L *e) {
   f_print(t, e);
-  putc('\n', out);
+  put('\n');
   return nil;
 }
 
@@ -767,7 +1241,7 @@ L f_write(L t, L *_) {
   for (; T(t) != NIL; t = cdr(t)) {
     x = car(t);
     if (T(x) == STRG)
-      fprintf(out, "%s", A+ord(x));
+      put(A+ord(x));
     else
       print(x);
   }
@@ -783,8 +1257,10 @@ L f_string(L t, L *_) {
     else if (T(x) == CONS)
       for (; T(x) == CONS; x = cdr(x))
         ++i;
-    else if (x == x) /* false when x is NaN i.e. a tagged Lisp expression */
-      i += snprintf(buf, sizeof(buf), FLOAT, x);
+    else if (x == x) { /* false when x is NaN i.e. a tagged Lisp expression */
+      char s[32];
+      i += format(s, x);
+    }
   }
   push(t);
   i = j = alloc(i);
@@ -797,15 +1273,116 @@ L f_string(L t, L *_) {
       for (; T(x) == CONS; x = cdr(x))
         *(A+i++) = car(x);
     else if (x == x) /* false when x is NaN i.e. a tagged Lisp expression */
-      i += snprintf(A+i, sizeof(buf), FLOAT, x);
+      i += format(A+i, x);
   }
   *(A+i) = 0;
   return box(STRG, j);
 }
 
+/* return the characters of string or symbol x, raises err(5) when x is not a string or symbol */
+const char *text(L x) {
+  return (T(x) & ~(ATOM^STRG)) == ATOM ? A+ord(x) : (err(5), "");
+}
+
+/* return a string of the characters of string t converted by f, e.g. toupper */
+L recase(L t, int (*f)(int)) {
+  L *p = push(t);
+  I n = strlen(text(car(t))), i = alloc(n);
+  const char *s = text(car(*p));                /* the string may have moved when alloc() ran the GC */
+  for (I k = 0; k <= n; ++k)
+    A[i+k] = f(static_cast<unsigned char>(s[k]));
+  unwind(sp+1);
+  return box(STRG, i);
+}
+
+L f_strlen(L t, L *_) {
+  return strlen(text(car(t)));
+}
+
+L f_strref(L t, L *_) {
+  const char *s = text(car(t));
+  L k = car(cdr(t));
+  return k >= 0 && k < strlen(s) ? static_cast<unsigned char>(s[static_cast<I>(k)]) : err(5);
+}
+
+L f_substring(L t, L *_) {
+  L *p = push(t), x = cdr(t), y = cdr(x), i = car(x), j = T(y) == CONS ? car(y) : strlen(text(car(t)));
+  if (!(0 <= i && i <= j && j <= strlen(text(car(t)))))
+    err(5);
+  I n = static_cast<I>(j)-static_cast<I>(i), k = alloc(n);
+  memcpy(A+k, text(car(*p))+static_cast<I>(i), n);
+  A[k+n] = 0;
+  unwind(sp+1);
+  return box(STRG, k);
+}
+
+L f_strindex(L t, L *_) {
+  const char *s = text(car(t)), *r;
+  L c = car(cdr(t)), x = cdr(cdr(t)), k = T(x) == CONS ? car(x) : 0;
+  I n = strlen(s);
+  if (!(0 <= k && k <= n))
+    err(5);
+  r = static_cast<const char*>(memchr(s+static_cast<I>(k), c == c ? static_cast<int>(c) : *text(c), n-static_cast<I>(k)));
+  return r ? r-s : nil;
+}
+
+L f_strsearch(L t, L *_) {
+  const char *s = text(car(t)), *u = text(car(cdr(t))), *r;
+  L x = cdr(cdr(t)), k = T(x) == CONS ? car(x) : 0;
+  I n = strlen(s);
+  if (!(0 <= k && k <= n))
+    err(5);
+  r = static_cast<const char*>(memmem(s+static_cast<I>(k), n-static_cast<I>(k), u, strlen(u)));
+  return r ? r-s : nil;
+}
+
+L f_strsplit(L t, L *_) {
+  L *p = push(t), *r = push(nil), *q = r, x = car(cdr(t));
+  std::string d = x == x ? std::string(1, static_cast<char>(x)) : text(x);
+  I k = 0, n = strlen(text(car(t)));
+  if (d.empty())
+    err(5);
+  while (1) {                                   /* split at each separator d, the string moves when alloc() runs GC */
+    const char *s = text(car(*p)), *e = static_cast<const char*>(memmem(s+k, n-k, d.data(), d.size()));
+    I m = e ? e-s-k : n-k, i = alloc(m);
+    memcpy(A+i, text(car(*p))+k, m);
+    A[i+m] = 0;
+    *q = cons(box(STRG, i), nil);
+    q = &CDR(*q);
+    if (!e)
+      break;
+    k += m+d.size();
+  }
+  x = *r;
+  unwind(sp+2);
+  return x;
+}
+
+L f_strnum(L t, L *_) {
+  L x;
+  return number(text(car(t)), &x) ? x : nil;
+}
+
+L f_numstr(L t, L *_) {
+  char s[32];
+  L n = car(t);
+  if ((T(n) & 0x7fff) > 0x7ff8)                 /* not a number but a NaN-boxed Lisp expression */
+    err(5);
+  s[format(s, n)] = 0;
+  return string(s);
+}
+
+L f_strupcase(L t, L *_) {
+  return recase(t, toupper);
+}
+
+L f_strdowncase(L t, L *_) {
+  return recase(t, tolower);
+}
+
 L f_load(L t, L *e) {
   L x = f_string(t, e);
-  return input(A+ord(x)) ? cons(atom("load"), cons(x, nil)) : ERR(5, "cannot read %s ", A+ord(x));
+  return load(std::string(A+ord(x)).c_str());
 }
 
 L f_trace(L t, L *e) {
@@ -814,24 +1391,256 @@ L f_trace(L t, L *e) {
   return more(t) ? t = eval(car(cdr(t)), *e), tr = savedtr, t : tr;
 }
 
+L f_tracerecord(L t, L *_) {
+  L x = car(t), y = more(t) ? car(cdr(t)) : nil;
+  if (!(x >= 0 && x <= 1 << 24))                /* up to 16M events of 16 bytes */
+    err(5);
+  record(static_cast<size_t>(x), T(y) == STRG ? A+ord(y) : NULL);
+  return nil;
+}
+
+L f_tracedump(L t, L *_) {
+  L x = car(t);
+  if (T(x) != STRG)
+    err(5);
+  dump(events(), x);
+  return nil;
+}
+
 L f_catch(L t, L *e) {
-  L x; I savedsp = sp;
+  L x; I savedsp = sp, savedpd = pf ? prof->fs.size() : 0, savedcn = cn++;
   try {
     x = eval(car(t), *e);
   }
   catch (int n) {
+    cn = savedcn;
+    sp = savedsp;                               /* unwind the stack first, it may be full */
+    if (pf)                                     /* the profiled closures and macros return */
+      leave(savedpd);
     x = cons(atom("ERR"), n);
   }
+  catch (...) {
+    cn = savedcn;
+    throw;
+  }
+  cn = savedcn;
   sp = savedsp;
   return x;
 }
 
 L f_throw(L t, L *_) {
-  throw static_cast<int>(num(car(t)));
+  return err(static_cast<int>(num(car(t))));
+}
+
+L f_serialize(L t, L *_) {
+  return string(serialize(car(t)).c_str());
+}
+
+L f_deserialize(L t, L *_) {
+  L x = car(t);
+  return T(x) == STRG ? deserialize(std::string(A+ord(x))) : err(5);
+}
+
+L f_pmap(L t, L *_) {
+  L *p = push(t), x = parallel(car(*p), car(cdr(*p)), 0);
+  unwind(sp+1);
+  return x;
+}
+
+L f_preduce(L t, L *_) {
+  L *p = push(t), x = cons(car(cdr(*p)), car(cdr(cdr(*p))));
+  *p = cons(car(*p), x);
+  x = parallel(car(*p), cdr(*p), 1);            /* reduce the list with the initial value in front */
+  unwind(sp+1);
+  return x;
+}
+
+L f_future(L t, L *e) {
+  return workers ? future(car(t), *e) : eval(car(t), *e); /* without workers evaluate <expr> now */
+}
+
+L f_touch(L t, L *_) {
+  return touch(car(t));
+}
+
+L f_delay(L t, L *e) {
+  return promise(cons(closure(nil, car(t), *e), nil));
+}
+
+L f_force(L t, L *_) {
+  return force(car(t));
+}
+
+L f_streamcons(L t, L *e) {
+  L *p = push(t), *x = push(eval(car(t), *e)), y = promise(cons(closure(nil, car(cdr(*p)), *e), nil));
+  y = cons(*x, y);
+  unwind(sp+2);
+  return y;
+}
+
+L f_streamcdr(L t, L *_) {
+  return force(cdr(force(car(t))));
+}
+
+L f_streamrange(L t, L *_) {
+  static const L g = primitive("stream-range");
+  L n = car(t), m = INFINITY, k = 1;
+  t = cdr(t);
+  if (T(t) == CONS) {                           /* (stream-range n m k) counts from n up to m (exclusive) by k */
+    m = car(t);
+    t = cdr(t);
+    if (T(t) == CONS)
+      k = car(t);
+  }
+  if (k < 0 ? !(m < n) : !(n < m))
+    return nil;
+  return cons(n, promise(cons(g, cons(n+k, cons(m, cons(k, nil))))));
+}
+
+L f_streammap(L t, L *_) {
+  static const L g = primitive("stream-map");
+  L *p = push(t), *s = push(force(car(cdr(t)))), *y, x = *s;
+  if (T(x) != CONS) {
+    unwind(sp+2);
+    return nil;
+  }
+  y = push(apply(car(*p), cons(car(x), nil)));
+  x = promise(cons(g, cons(car(*p), cons(cdr(*s), nil))));
+  x = cons(*y, x);
+  unwind(sp+3);
+  return x;
+}
+
+L f_streamfilter(L t, L *_) {
+  static const L g = primitive("stream-filter");
+  L *p = push(t), *s = push(force(car(cdr(t)))), x = *s;
+  while (T(x) == CONS && Not(apply(car(*p), cons(car(x), nil)))) {
+    x = force(cdr(*s));                         /* skip elements of the stream that do not satisfy the predicate */
+    *s = x;
+  }
+  if (T(x) == CONS) {
+    x = promise(cons(g, cons(car(*p), cons(cdr(*s), nil))));
+    x = cons(car(*s), x);
+  }
+  unwind(sp+2);
+  return x;
+}
+
+L f_streamtake(L t, L *_) {
+  L n = car(t), *s = push(force(car(cdr(t)))), *r = push(nil), *q = r, x = *s;
+  for (; n > 0 && T(x) == CONS; --n) {          /* a list of the first n elements, forces no more than needed */
+    *q = cons(car(x), nil);
+    q = &CDR(*q);
+    if (n > 1) {
+      x = force(cdr(*s));
+      *s = x;
+    }
+  }
+  x = *r;
+  unwind(sp+2);
+  return x;
+}
+
+L f_profile(L t, L *e) {
+  L x;
+  if (pf & 1)                                   /* already profiling */
+    return eval(car(t), *e);
+  profile(1);
+  try {
+    x = eval(car(t), *e);
+  }
+  catch (...) {
+    profile(0);
+    throw;
+  }
+  profile(0);
+  push(x);
+  x = more(t) ? eval(car(cdr(t)), *e) : nil;
+  if (T(x) == STRG)                             /* write the folded stacks to the file named x */
+    dump(folded(), x);
+  else {
+    std::string s = report(T(x) == ATOM ? A+ord(x) : "self");
+    put(s.data(), s.size());
+  }
+  return pop();
+}
+
+L f_sample(L t, L *e) {
+  L x, y;
+  if (pf & 2)                                   /* already sampling */
+    return eval(car(t), *e);
+  x = more(t) ? eval(car(cdr(t)), *e) : 1000;
+  if (!(x >= 1 && x <= 1e6))
+    err(5);
+  sample(static_cast<unsigned>(x));
+  try {
+    x = eval(car(t), *e);
+  }
+  catch (...) {
+    sample(0);
+    throw;
+  }
+  sample(0);
+  push(x);
+  y = more(t) && more(cdr(t)) ? eval(car(cdr(cdr(t))), *e) : nil;
+  if (T(y) == STRG)                             /* write the folded stacks to the file named y */
+    dump(samples(), y);
+  else {
+    std::string s = samples();
+    put(s.data(), s.size());
+  }
+  return pop();
+}
+
+L f_census(L t, L *e) {
+  L x = nil; I on = pf & 4;
+  if (T(t) == CONS) {                           /* track the allocations of the evaluation */
+    track(1);
+    try {
+      x = eval(car(t), *e);
+    }
+    catch (...) {
+      track(on);
+      throw;
+    }
+  }
+  push(x);
+  std::string s = census();
+  put(s.data(), s.size());
+  track(on);
+  return pop();
+}
+
+L f_spawn(L t, L *_) {
+  return spawn(car(t));
+}
+
+L f_yield(L t, L *_) {
+  yield();
+  return nil;
+}
+
+L f_chan(L t, L *_) {
+  return cons(nil, nil);
+}
+
+L f_send(L t, L *_) {
+  L *p = push(t), x = send(car(*p), car(cdr(*p)));
+  unwind(sp+1);
+  return x;
+}
+
+L f_recv(L t, L *_) {
+  return recv(car(t));
+}
+
+L f_suspend(L t, L *_) {
+  return suspend(car(t));
 }
 
 struct QUIT { };
 L f_quit(L t, L *_) {
+  STAT(fprintf(stderr, "gc %u stack %u\n", gcs, N-ms));
   throw QUIT();
 }
 
@@ -843,12 +1652,16 @@ protected:
 /* evaluation mode of a primitive */
 static const uint8_t NORMAL = 0, SPECIAL = 1, TAILCALL = 2;
 
+/* the kinds of continuation frames of step(), which evaluates the special forms BEGIN to LETRECA and SETQ to FORCE
+   with frames, their primitives have mode m = kind << 2 */
+enum { BEGIN = 1, IF, COND, AND, OR, LET, LETA, LETREC, LETRECA, APPL, EXPAND, SETQ, DEFINE, CATCH, FORCE };
+
 /* table of Lisp primitives, each has a name s, a function pointer f, and an evaluation mode m */
 inline static const struct {
   const char *s;
   std::function<L(This&,L,L*)> f;
   uint8_t m;
-} prim[43] = {
+} prim[80] = {
   {"type",     &This::f_type,    NORMAL},           /* (type x) => <type> value between -1 and 7 */
   {"eval",     &This::f_ident,   NORMAL|TAILCALL},  /* (eval <quoted-expr>) => <value-of-expr> */
   {"quote",    &This::f_ident,   SPECIAL},          /* (quote <expr>) => <expr> -- protect <expr> from evaluation */
@@ -863,22 +1676,22 @@ inline static const struct {
   {"<",        &This::f_lt,      NORMAL},           /* (< n1 n2) => #t if n1<n2 else () */
   {"eq?",      &This::f_eq,      NORMAL},           /* (eq? x y) => #t if x==y else () */
   {"not",      &This::f_not,     NORMAL},           /* (not x) => #t if x==() else ()t */
-  {"or",       &This::f_or,      SPECIAL},          /* (or x1 x2 ... xk) => #t if any x1 is not () else () */
-  {"and",      &This::f_and,     SPECIAL},          /* (and x1 x2 ... xk) => #t if all x1 are not () else () */
-  {"begin",    &This::f_begin,   SPECIAL|TAILCALL}, /* (begin x1 x2 ... xk) => xk -- evaluates x1, x2 to xk */
+  {"or",       &This::f_or,      SPECIAL|OR << 2},  /* (or x1 x2 ... xk) => #t if any x1 is not () else () */
+  {"and",      &This::f_and,     SPECIAL|AND << 2}, /* (and x1 x2 ... xk) => #t if all x1 are not () else () */
+  {"begin",    &This::f_begin,   SPECIAL|TAILCALL|BEGIN << 2}, /* (begin x1 x2 ... xk) => xk -- evaluates x1, x2 to xk */
   {"while",    &This::f_while,   SPECIAL},          /* (while x y1 y2 ... yk) -- while x is not () eval y1, y2 ... yk */
-  {"cond",     &This::f_cond,    SPECIAL|TAILCALL}, /* (cond (x1 y1) (x2 y2) ... (xk yk)) => yi for first xi!=() */
-  {"if",       &This::f_if,      SPECIAL|TAILCALL}, /* (if x y z) => if x!=() then y else z */
+  {"cond",     &This::f_cond,    SPECIAL|TAILCALL|COND << 2}, /* (cond (x1 y1) (x2 y2) ... (xk yk)) => yi for first xi!=() */
+  {"if",       &This::f_if,      SPECIAL|TAILCALL|IF << 2}, /* (if x y z) => if x!=() then y else z */
   {"lambda",   &This::f_lambda,  SPECIAL},          /* (lambda <parameters> <expr>) => {closure} */
   {"macro",    &This::f_macro,   SPECIAL},          /* (macro <parameters> <expr>) => [macro] */
-  {"define",   &This::f_define,  SPECIAL},          /* (define <symbol> <expr>) -- globally defines <symbol> */
+  {"define",   &This::f_define,  SPECIAL|DEFINE << 2}, /* (define <symbol> <expr>) -- globally defines <symbol> */
   {"assoc",    &This::f_assoc,   NORMAL},           /* (assoc <quoted-symbol> <environment>) => <value-of-symbol> */
   {"env",      &This::f_env,     NORMAL},           /* (env) => <environment> */
-  {"let",      &This::f_let,     SPECIAL|TAILCALL}, /* (let (v1 x1) (v2 x2) ... (vk xk) y) => y with scope */
-  {"let*",     &This::f_leta,    SPECIAL|TAILCALL}, /* (let* (v1 x1) (v2 x2) ... (vk xk) y) => y with scope */
-  {"letrec",   &This::f_letrec,  SPECIAL|TAILCALL}, /* (letrec (v1 x1) (v2 x2) ... (vk xk) y) => y recursive scope */
-  {"letrec*",  &This::f_letreca, SPECIAL|TAILCALL}, /* (letrec* (v1 x1) (v2 x2) ... (vk xk) y) => y recursive scope */
-  {"setq",     &This::f_setq,    SPECIAL},          /* (setq <symbol> x) -- changes value of <symbol> in scope to x */
+  {"let",      &This::f_let,     SPECIAL|TAILCALL|LET << 2}, /* (let (v1 x1) (v2 x2) ... (vk xk) y) => y with scope */
+  {"let*",     &This::f_leta,    SPECIAL|TAILCALL|LETA << 2}, /* (let* (v1 x1) (v2 x2) ... (vk xk) y) => y with scope */
+  {"letrec",   &This::f_letrec,  SPECIAL|TAILCALL|LETREC << 2}, /* (letrec (v1 x1) (v2 x2) ... (vk xk) y) => y recursive scope */
+  {"letrec*",  &This::f_letreca, SPECIAL|TAILCALL|LETRECA << 2}, /* (letrec* (v1 x1) (v2 x2) ... (vk xk) y) => y recursive scope */
+  {"setq",     &This::f_setq,    SPECIAL|SETQ << 2}, /* (setq <symbol> x) -- changes value of <symbol> in scope to x */
   {"set-car!", &This::f_setcar,  NORMAL},           /* (set-car! <pair> x) -- changes car of <pair> to x in memory */
   {"set-cdr!", &This::f_setcdr,  NORMAL},           /* (set-cdr! <pair> y) -- changes cdr of <pair> to y in memory */
   {"read",     &This::f_read,    NORMAL},           /* (read) => <value-of-input> */
@@ -886,10 +1699,47 @@ inline static const struct {
   {"println",  &This::f_println, NORMAL},           /* (println x1 x2 ... xk) => () -- prints with newline */
   {"write",    &This::f_write,   NORMAL},           /* (write x1 x2 ... xk) => () -- prints without quoting strings */
   {"string",   &This::f_string,  NORMAL},           /* (string x1 x2 ... xk) => <string> -- string of x1 x2 ... xk */
-  {"load",     &This::f_load,    NORMAL},           /* (load <name>) -- loads file <name> (an atom or string name) */
+  {"string-length",   &This::f_strlen,      NORMAL}, /* (string-length <string>) => <number> of characters */
+  {"string-ref",      &This::f_strref,      NORMAL}, /* (string-ref <string> n) => <character code> at n */
+  {"substring",       &This::f_substring,   NORMAL}, /* (substring <string> n [m]) => <string> from n to m */
+  {"string-append",   &This::f_string,      NORMAL}, /* (string-append x1 x2 ... xk) => <string> like string */
+  {"string-index",    &This::f_strindex,    NORMAL}, /* (string-index <string> c [n]) => position of c or () */
+  {"string-search",   &This::f_strsearch,   NORMAL}, /* (string-search <string> <substr> [n]) => position or () */
+  {"string-split",    &This::f_strsplit,    NORMAL}, /* (string-split <string> <separator>) => list of <string> */
+  {"string->number",  &This::f_strnum,      NORMAL}, /* (string->number <string>) => <number> or () */
+  {"number->string",  &This::f_numstr,      NORMAL}, /* (number->string n) => <string> */
+  {"string-upcase",   &This::f_strupcase,   NORMAL}, /* (string-upcase <string>) => <string> in upper case */
+  {"string-downcase", &This::f_strdowncase, NORMAL}, /* (string-downcase <string>) => <string> in lower case */
+  {"load",     &This::f_load,    NORMAL},           /* (load <name>) => <value> -- loads file <name> (an atom or string name) */
   {"trace",    &This::f_trace,   SPECIAL},          /* (trace flag [<expr>]) -- flag 0=off, 1=on, 2=keypress */
-  {"catch",    &This::f_catch,   SPECIAL},          /* (catch <expr>) => <value-of-expr> if no except. else (ERR . n) */
+  {"trace-record", &This::f_tracerecord, NORMAL},   /* (trace-record n [<file>]) -- record the last n events */
+  {"trace-dump", &This::f_tracedump, NORMAL},       /* (trace-dump <file>) -- write the recorded events */
+  {"catch",    &This::f_catch,   SPECIAL|CATCH << 2}, /* (catch <expr>) => <value-of-expr> if no except. else (ERR . n) */
   {"throw",    &This::f_throw,   NORMAL},           /* (throw n) -- raise exception error code n (integer != 0) */
+  {"serialize",   &This::f_serialize,   NORMAL},   /* (serialize x) => <string> -- compact binary string of x */
+  {"deserialize", &This::f_deserialize, NORMAL},   /* (deserialize <string>) => x -- x from its serialized <string> */
+  {"pmap",     &This::f_pmap,    NORMAL},           /* (pmap f <list>) => (f x1) (f x2) ... in parallel */
+  {"preduce",  &This::f_preduce, NORMAL},           /* (preduce f x <list>) => (f ... (f (f x x1) x2) ... xk) parallel */
+  {"future",   &This::f_future,  SPECIAL},          /* (future <expr>) => <future> -- evaluates <expr> in parallel */
+  {"touch",    &This::f_touch,   NORMAL},           /* (touch <future>) => <value-of-expr> -- waits for the future */
+  {"delay",    &This::f_delay,   SPECIAL},          /* (delay <expr>) => <promise> -- to evaluate <expr> when forced */
+  {"force",    &This::f_force,   NORMAL|FORCE << 2}, /* (force <promise>) => <value-of-expr> -- evaluated once */
+  {"stream-cons",   &This::f_streamcons,   SPECIAL}, /* (stream-cons x <expr>) => (x . <promise-of-expr>) */
+  {"stream-car",    &This::f_car,          NORMAL},  /* (stream-car <stream>) => x -- the first element */
+  {"stream-cdr",    &This::f_streamcdr,    NORMAL},  /* (stream-cdr <stream>) => <stream> -- the rest, forced */
+  {"stream-range",  &This::f_streamrange,  NORMAL},  /* (stream-range n [m [k]]) => <stream> of n, n+k, ... below m */
+  {"stream-map",    &This::f_streammap,    NORMAL},  /* (stream-map f <stream>) => <stream> of (f x1) (f x2) ... */
+  {"stream-filter", &This::f_streamfilter, NORMAL},  /* (stream-filter f <stream>) => <stream> of xi with (f xi) */
+  {"stream-take",   &This::f_streamtake,   NORMAL},  /* (stream-take n <stream>) => (x1 x2 ... xn) */
+  {"profile",  &This::f_profile, SPECIAL},          /* (profile <expr> [<key>|<file>]) => <value-of-expr> -- profile */
+  {"sample",   &This::f_sample,  SPECIAL},          /* (sample <expr> [<hz> [<file>]]) => <value-of-expr> -- sample */
+  {"heap-census", &This::f_census, SPECIAL},        /* (heap-census [<expr>]) => <value-of-expr> -- live objects */
+  {"spawn",    &This::f_spawn,   NORMAL},           /* (spawn f) => <number> -- runs (f) in a new process */
+  {"yield",    &This::f_yield,   NORMAL},           /* (yield) => () -- lets the other ready processes run */
+  {"chan",     &This::f_chan,    NORMAL},           /* (chan) => <channel> -- a new empty channel */
+  {"send",     &This::f_send,    NORMAL},           /* (send <channel> x) => x -- queues x on the channel */
+  {"recv",     &This::f_recv,    NORMAL},           /* (recv <channel>) => x -- waits for x queued on the channel */
+  {"suspend",  &This::f_suspend, NORMAL},           /* (suspend x) => y -- waits for the host to resume with y */
   {"quit",     &This::f_quit,    NORMAL},           /* (quit) -- bye! */
   {0}
 };
@@ -902,100 +1752,484 @@ public:
 
 /* trace the evaluation of x in environment e, returns its value */
 L eval(L x, L e) {
-  L y;
   if (!tr)
     return step(x, e);                          /* eval() -> step() tail call when not tracing */
-  y = step(x, e);
-  printf("%4u: ", N-sp); print(x);              /* <stack depth>: unevaluated expression */
-  printf(" => ");        print(y);              /* => value of the expression */
-  if (tr > 1)                                   /* wait for ENTER key or other CTRL */
+  return trace(x, step(x, e));
+}
+
+/* evaluate x in environment e before deadline t or raise err(13), x must be protected from getting GC'ed by the caller */
+L eval(L x, L e, std::chrono::steady_clock::time_point t) {
+  auto d = due;
+  if (t < due)                                  /* the earliest deadline applies to nested evaluations */
+    due = t;
+  tk = 1;
+  try {
+    x = eval(x, e);
+  }
+  catch (...) {
+    due = d;
+    throw;
+  }
+  due = d;
+  return x;
+}
+
+protected:
+
+/* trace expression x evaluated to y, returns y */
+L trace(L x, L y) {
+  char s[16];
+  put(s, snprintf(s, sizeof(s), "%4u: ", N-sp)); print(x);  /* <stack depth>: unevaluated expression */
+  put(" => ");                                  print(y);  /* => value of the expression */
+  if (tr > 1) {                                 /* wait for ENTER key or other CTRL */
+    flush();
     while (getchar() >= ' ')
       continue;
+  }
   else
-    putchar('\n');
+    put('\n');
   return y;
 }
 
-protected:
-
-/* step-wise evaluate x in environment e, returns value of x, tail-call optimized */
+/* step-wise evaluate x in environment e, returns value of x, tail-call optimized and stackless: the evaluation of the
+   function, the arguments and the tests of special forms pushes a continuation frame on the stack instead of calling
+   eval() recursively, so the depth of recursion is limited by the stack space only, an error raised in the scope of a
+   catch frame is caught by the step that pushed the frame */
 L step(L x, L e) {
-  L *f, v, *d, *y, *z; I k = sp;                /* save sp to unwind the stack back to sp afterwards */
-  f = push(nil);                                /* protect closure f from getting GC'ed */
-  d = push(nil);                                /* protect new bindings d from getting GC'ed */
-  y = push(nil);                                /* protect alias y of new x from getting GC'ed */
-  z = push(nil);                                /* protect alias z of new e from getting GC'ed */
-  while (1) {
+  L *y, *z, *w, f, v, t, h = nil; I k = sp, b, q, pd = ~0U, i, c, s, m = cn, r = 0; /* save sp to unwind to sp */
+  deep();                                       /* primitives may evaluate recursively in C, check the C stack */
+  y = push(x);                                  /* protect alias y of x from getting GC'ed */
+  z = push(e);                                  /* protect alias z of e from getting GC'ed */
+  b = q = sp;                                   /* q is the frame on top, none when q is at the bottom b */
+  /* push a frame of kind c with n fields w[] set to (), the frame also holds the kind, n and the previous frame q,
+     and the profiled frames pd and the closure h applied by the step that pushed the frame */
+  auto frame = [&](I c, I n) {
+    room(n+3);                                  /* may GC, so the values stored in the frame are computed after */
+    sp -= n;
+    std::fill(cell+sp, cell+sp+n, nil);
+    cell[--sp] = h;
+    cell[--sp] = pd;
+    cell[--sp] = c + 16.0*n + 256.0*q;
+    STAT(if (sp < ms) ms = sp);                 /* track the peak stack depth */
+    q = sp;
+    w = cell+q+3;
+  };
+  /* start a new step of frame q to evaluate expression s, like a recursive step(s, e) */
+  auto sub = [&](L s) {
+    x = s;
+    pd = ~0U;
+    h = nil;
+  };
+  /* pop frame q to continue the step that pushed it */
+  auto done = [&] {
+    uint64_t u = cell[q];
+    pd = cell[q+1];
+    h = cell[q+2];
+    sp = q+3+(u >> 4 & 15);
+    q = u >> 8;
+  };
+  /* bind value v to the next parameter w[1] in the new environment w[4] or add v to the reversed list w[5] */
+  auto arg = [&](L v) {
+    if (T(w[1]) == CONS) {
+      w[4] = pair(car(w[1]), v, w[4]);
+      w[1] = cdr(w[1]);
+    }
+    else
+      w[5] = cons(v, w[5]);
+  };
+  /* closure or macro f is applied in the step that pushed frame q, its profiled frames and closure h are saved in the
+     frame */
+  auto called = [&](L f) {
+    I s = cell[q+1];
+    if (pf) {                                   /* profile the application of f */
+      enter(f, s, static_cast<uint64_t>(cell[q]) >> 8);
+      cell[q+1] = s;
+    }
+    L v = cell[q+2];
+    if (T(v) != NIL)                            /* a tail call, the closure or macro applied before returns */
+      left(v);
+    entered(cell[q+2] = f);
+  };
+resume:                                         /* continue with the value x of a catch frame after an error */
+  try {
+    if (r)
+      goto ret;
+eval:                                           /* evaluate x in environment e */
+    *y = x;
+    *z = e;
     if (T(x) == ATOM) {                         /* if x is an atom, then return its associated value */
       x = assoc(x, e);
-      break;
+      goto ret;
     }
     if (T(x) != CONS)                           /* if x is not a list or pair, then return x itself */
-      break;
-    *f = eval(car(x), e);                       /* the function/primitive is at the head of the list */
+      goto ret;
+    f = car(x);                                 /* the function/primitive is at the head of the list */
+    if (T(f) == CONS || tr) {                   /* if f is an expression, then evaluate it in a new step of a frame */
+      frame(APPL, 6);
+      w[2] = x;
+      w[3] = e;
+      sub(car(x));
+      goto eval;
+    }
+    if (T(f) == ATOM)
+      f = assoc(f, e);
     x = cdr(x);                                 /* ... and its actual arguments are the rest of the list */
-    if (T(*f) == PRIM) {                        /* if f is a primitive, then apply it to the actual arguments x */
-      I i = ord(*f);
-      if (!(prim[i].m & SPECIAL))               /* if the primitive is NORMAL mode, */
-        x = evlis(x, e);                        /* ... then evaluate actual arguments x */
-      *z = e;
-      x = *y = prim[i].f(*this, x, z);          /* call the primitive with arguments x, put return value back in x */
-      e = *z;                                   /* the new environment e is d to evaluate x, put in *z to protect */
-      if (prim[i].m & TAILCALL)                 /* if the primitive is TAILCALL mode, */
-        continue;                               /* ... then continue evaluating x */
-      break;                                    /* else break to return value x */
-    }
-    if ((T(*f) & ~(CLOS^MACR)) != CLOS)         /* if f is not a closure or macro, then we cannot apply it */
-      err(4);
-    if (T(*f) == CLOS) {                        /* if f is a closure, then */
-      *d = cdr(*f);                             /* construct an extended local environment d from f's static scope */
-      if (T(*d) == NIL)                         /* if f's static scope is nil, then use global env as static scope */
-        *d = env;
-      v = car(car(*f));                         /* get the parameters v of closure f */
-      while (T(v) == CONS && T(x) == CONS) {    /* bind parameters v to argument values x to extend the local scope d */
-        *d = pair(car(v), eval(car(x), e), *d); /* add new binding to the front of d */
-        v = cdr(v);
-        x = cdr(x);
+    if (T(f) == PRIM && ((prim[ord(f)].m & SPECIAL) || T(x) == NIL))
+      goto prim;                                /* apply a special form or a primitive without arguments */
+    frame(APPL, 6);                             /* push a frame to evaluate the arguments x in e */
+    w[0] = f;
+    w[2] = x;
+    w[3] = e;
+apply:                                          /* apply w[0] to the arguments w[2] in environment w[3] */
+    f = w[0];
+    if (T(f) == PRIM) {
+      if (prim[ord(f)].m & SPECIAL) {           /* if f is a special form, then apply it to the unevaluated arguments */
+        x = w[2];
+        e = w[3];
+        done();
+        goto prim;
       }
-      if (T(v) == CONS) {                       /* condinue binding v if x is after a dot (... . x) by evaluating x */
-        *y = eval(x, e);                        /* evaluate x and save its value y to protect it from getting GC'ed */
-        while (T(v) == CONS && T(*y) == CONS) {
-          *d = pair(car(v), car(*y), *d);       /* add new binding to the front of d */
-          v = cdr(v);
-          *y = cdr(*y);
-        }
+    }
+    else if ((T(f) & ~(CLOS^MACR)) == CLOS) {   /* if f is a closure or macro, then apply it in the step that pushed */
+      poll();                                   /* a safe point to break when an interrupt was requested */
+      if (T(f) == MACR) {                       /* if f is a macro, then */
+        called(f);
+        w[4] = env;                             /* construct an extended local environment from global env */
+        for (v = car(f), x = w[2]; T(v) == CONS && T(x) == CONS; v = cdr(v), x = cdr(x))
+          w[4] = pair(car(v), car(x), w[4]);    /* bind parameters v to arguments x to extend the local scope */
         if (T(v) == CONS)                       /* error if insufficient actual arguments x are provided */
           err(4);
-        x = *y;
+        if (T(v) != NIL)                        /* if last parameter v is after a dot (... . v) then bind it to x */
+          w[4] = pair(v, x, w[4]);
+        cell[q] += EXPAND-APPL;                 /* the frame continues with the evaluation of the expansion */
+        e = w[4];
+        sub(cdr(f));                            /* evaluate the body of the macro in a new step to expand it */
+        goto eval;
       }
-      else if (T(x) == CONS)                    /* if more arguments x are provided then evaluate them all */
-        x = evlis(x, e);
-      else if (T(x) != NIL)                     /* else if last argument x is after a dot (... . x) then evaluate x */
-        x = eval(x, e);
-      if (T(v) != NIL)                          /* if last parameter v is after a dot (... . v) then bind it to x */
-        *d = pair(v, x, *d);
-      x = *y = cdr(car(*f));                    /* tail recursion optimization: evaluate the body x of closure f next */
-      e = *z = *d;                              /* the new environment e is d to evaluate x, put in *z to protect */
-    }
-    else {                                      /* else if f is a macro, then */
-      *d = env;                                 /* construct an extended local environment d from global env */
-      v = car(*f);                              /* get the parameters v of macro f */
-      while (T(v) == CONS && T(x) == CONS) {    /* bind parameters v to arguments x to extend the local scope d */
-        *d = pair(car(v), car(x), *d);
-        v = cdr(v);
-        x = cdr(x);
+      v = cdr(f);                               /* construct an extended local environment from f's static scope */
+      w[4] = T(v) == NIL ? env : v;             /* if f's static scope is nil, then use global env as static scope */
+      w[1] = car(car(f));                       /* the parameters of closure f to bind */
+    }
+    else
+      err(4);
+args:                                           /* bind or list the values of the arguments w[2] */
+    for (x = w[2]; T(x) == CONS; x = w[2] = cdr(x)) {
+      v = car(x);
+      if (T(v) == CONS || tr) {                 /* evaluate an argument expression in a new step of the frame */
+        e = w[3];
+        sub(v);
+        goto eval;
       }
-      if (T(v) == CONS)                         /* error if insufficient actual arguments x are provided */
-        err(4);
-      if (T(v) != NIL)                          /* if last parameter v is after a dot (... . v) then bind it to x */
-        *d = pair(v, x, *d);
-      x = *y = eval(cdr(*f), *d);               /* evaluated body of the macro to evaluate next, put in *z to protect */
+      arg(T(v) == ATOM ? assoc(v, w[3]) : v);
     }
-  }
-  unwind(k);                                    /* unwind the stack to allow GC to collect unused temporaries */
-  return x;                                     /* return x evaluated */
-}
-
+    f = w[0];
+    if (T(x) != NIL) {                          /* if the arguments end in a dot (... . x) then evaluate x */
+      x = w[2] = T(x) == ATOM ? assoc(x, w[3]) : T(f) != PRIM ? x : nil;
+      while (v = w[1], T(v) == CONS && T(x) == CONS) {
+        arg(car(x));                            /* bind the parameters to the values in list x */
+        x = w[2] = cdr(x);
+      }
+    }
+    v = w[1];
+    if (T(v) == CONS)                           /* error if insufficient actual arguments are provided */
+      err(4);
+    for (t = w[5]; T(t) != NIL; x = t, t = w[5]) { /* reverse the list of values in place to end in x */
+      w[5] = cdr(t);
+      CDR(t) = x;
+    }
+    if (T(f) == PRIM) {                         /* if f is a primitive, then apply it to the list of values */
+      e = w[3];
+      done();
+      goto prim;
+    }
+    if (T(v) != NIL)                            /* if last parameter v is after a dot (... . v) then bind it to x */
+      w[4] = pair(v, x, w[4]);
+    called(f);                                  /* closure f is entered after its arguments are evaluated */
+    x = cdr(car(f));                            /* tail recursion optimization: evaluate the body x of closure f next */
+    e = w[4];                                   /* in the new environment */
+    done();
+    goto eval;
+prim:                                           /* apply primitive f to the arguments x in environment e */
+    *y = x;
+    *z = e;
+    i = ord(f);
+    switch (c = prim[i].m >> 2) {               /* special forms are evaluated with frames */
+      case BEGIN:
+        t = x;
+        goto seq;
+      case IF:
+        v = car(x);
+        if (T(v) == CONS || tr) {
+          frame(IF, 2);
+          w[0] = x;
+          w[1] = e;
+          sub(car(x));
+          goto eval;
+        }
+        if (T(v) == ATOM)
+          v = assoc(v, e);
+        if (Not(v)) {
+          t = cdr(cdr(x));
+          goto seq;
+        }
+        x = car(cdr(x));
+        goto eval;
+      case COND:
+        t = x;
+        goto cond;
+      case AND:
+      case OR:
+        t = x;
+        x = nil;
+        goto andor;
+      case LET:
+      case LETA:
+      case LETREC:
+      case LETRECA:
+        frame(c, 4);
+        w[0] = x;                               /* the list of bindings */
+        w[1] = e;                               /* the new environment */
+        w[2] = e;                               /* the environment of let */
+        if (c == LETREC) {                      /* bind all variables to () first */
+          for (t = x; more(t); t = cdr(t))
+            w[1] = pair(car(car(t)), nil, w[1]);
+          w[3] = w[1];
+        }
+        goto let;
+    }
+    s = ap;
+    if (pf)                                     /* record the call or attribute allocations to the primitive */
+      call(i);
+    hooks.prim(prim[i].s);
+    PROBE1(prim, prim[i].s);
+    switch (c) {                                /* evaluate setq, define, catch and force with frames */
+      case SETQ:
+      case DEFINE:
+        frame(c, 2);
+        w[0] = x;
+        w[1] = e;
+        sub(car(cdr(x)));
+        goto eval;
+      case CATCH:
+        frame(c, 4);
+        w[0] = x;
+        w[1] = e;
+        w[2] = cn++;                            /* an error raised in the scope of the frame is caught */
+        w[3] = pf ? prof->fs.size() : 0;
+        sub(car(x));
+        goto eval;
+      case FORCE:
+        ap = s;
+        v = car(x);
+        if (T(v) != PROM) {                     /* forcing a value that is not a promise returns the value */
+          x = v;
+          goto ret;
+        }
+        if (equ(CDR(v), tru)) {                 /* the promise was forced before */
+          x = CAR(v);
+          goto ret;
+        }
+        frame(c, 2);
+        w[0] = v;
+        w[1] = application(car(CAR(v)), cdr(CAR(v)));
+        e = env;
+        sub(w[1]);
+        goto eval;
+    }
+    x = *y = prim[i].f(*this, x, z);            /* call the primitive with arguments x, put return value back in x */
+    ap = s;
+    e = *z;                                     /* the new environment e is d to evaluate x, put in *z to protect */
+    if (prim[i].m & TAILCALL)                   /* if the primitive is TAILCALL mode, */
+      goto eval;                                /* ... then continue evaluating x */
+    goto ret;                                   /* else return value x */
+seq:                                            /* evaluate the list of expressions t, the last one in tail position */
+    for (; more(t); t = cdr(t)) {
+      v = car(t);
+      if (T(v) == CONS || tr) {
+        *y = t;
+        *z = e;
+        frame(BEGIN, 2);
+        w[0] = t;
+        w[1] = e;
+        sub(car(t));
+        goto eval;
+      }
+      if (T(v) == ATOM)
+        assoc(v, e);
+    }
+    x = T(t) == NIL ? nil : car(t);
+    goto eval;
+cond:                                           /* find the first clause in list t with a test that is not () */
+    for (; T(t) != NIL; t = cdr(t)) {
+      v = car(car(t));
+      if (T(v) == CONS || tr) {
+        *y = t;
+        *z = e;
+        frame(COND, 2);
+        w[0] = t;
+        w[1] = e;
+        sub(car(car(t)));
+        goto eval;
+      }
+      if (!Not(T(v) == ATOM ? assoc(v, e) : v))
+        break;
+    }
+    if (T(t) == NIL) {
+      x = nil;
+      goto ret;
+    }
+    t = cdr(car(t));
+    goto seq;
+andor:                                          /* evaluate the list t until value x is () for and, not () for or */
+    for (; T(t) != NIL; t = cdr(t)) {
+      v = car(t);
+      if (T(v) == CONS || tr) {
+        *y = t;
+        *z = e;
+        frame(c, 2);
+        w[0] = t;
+        w[1] = e;
+        sub(car(t));
+        goto eval;
+      }
+      x = T(v) == ATOM ? assoc(v, e) : v;
+      if (Not(x) == (c == AND))
+        break;
+    }
+    goto ret;
+let:                                            /* bind the values of the bindings w[0] in a new step of the frame */
+    if (more(w[0])) {
+      if (c == LETRECA)
+        w[1] = pair(car(car(w[0])), nil, w[1]);
+      e = c == LET ? w[2] : w[1];
+      t = cdr(car(w[0]));
+      sub(t);
+      goto seq;
+    }
+    t = w[0];                                   /* evaluate the body in the new environment next */
+    e = w[1];
+    done();
+    x = T(t) == NIL ? nil : car(t);
+    goto eval;
+ret:                                            /* the step returns value x */
+    if (pd != ~0U && pf)                        /* the profiled closures or macros applied in this step return */
+      leave(pd);
+    if (T(h) != NIL)                            /* the closure or macro applied in this step returns */
+      left(h);
+    if (q == b) {
+      unwind(k);                                /* unwind the stack to allow GC to collect unused temporaries */
+      return x;                                 /* return x evaluated */
+    }
+    sp = q;                                     /* unwind the stack to the frame on top that continues */
+    w = cell+q+3;
+    c = static_cast<uint64_t>(cell[q]) & 15;
+    if (tr)                                     /* trace the expression evaluated by the step */
+      trace(c == APPL ? car(w[2]) : c == EXPAND ? cdr(w[0]) : c == COND ? car(car(w[0])) : c == SETQ || c == DEFINE ?
+          car(cdr(w[0])) : c == FORCE ? w[1] : c < LET || c == CATCH ? car(w[0]) : car(cdr(car(w[0]))), x);
+    switch (c) {
+      case APPL:
+        f = w[0];
+        if (T(f) == NIL) {                      /* x is the function/primitive to apply */
+          w[0] = x;
+          w[2] = cdr(w[2]);
+          goto apply;
+        }
+        arg(x);                                 /* x is the value of the argument */
+        w[2] = cdr(w[2]);
+        goto args;
+      case EXPAND:                              /* x is the expansion of a macro to evaluate next */
+        e = w[3];
+        done();
+        goto eval;
+      case BEGIN:
+        t = cdr(w[0]);
+        e = w[1];
+        done();
+        goto seq;
+      case IF:
+        t = w[0];
+        e = w[1];
+        done();
+        if (Not(x)) {
+          t = cdr(cdr(t));
+          goto seq;
+        }
+        x = car(cdr(t));
+        goto eval;
+      case COND:
+        t = w[0];
+        e = w[1];
+        done();
+        if (Not(x)) {
+          t = cdr(t);
+          goto cond;
+        }
+        t = cdr(car(t));
+        goto seq;
+      case AND:
+      case OR:
+        t = w[0];
+        e = w[1];
+        done();
+        if (Not(x) == (c == AND))
+          goto ret;
+        t = cdr(t);
+        goto andor;
+      case SETQ:
+        x = assign(car(w[0]), x, w[1]);
+        done();
+        goto ret;
+      case DEFINE:
+        env = pair(car(w[0]), x, env);
+        x = car(w[0]);
+        done();
+        goto ret;
+      case CATCH:
+        cn = w[2];
+        done();
+        goto ret;
+      case FORCE:
+        t = w[0];
+        if (!equ(CDR(t), tru)) {                /* the first value is kept when forced again while evaluating */
+          CAR(t) = x;
+          CDR(t) = tru;
+        }
+        x = CAR(t);
+        done();
+        goto ret;
+    }
+    if (c == LETREC) {                          /* x is the value of a binding of let, let*, letrec or letrec* */
+      CDR(car(w[3])) = x;
+      w[3] = cdr(w[3]);
+    }
+    else if (c == LETRECA)
+      CDR(car(w[1])) = x;
+    else
+      w[1] = pair(car(car(w[0])), x, w[1]);
+    w[0] = cdr(w[0]);
+    goto let;
+  }
+  catch (int n) {                               /* error n is caught by the catch frame on top, if any in this step */
+    for (i = q; i != b && (static_cast<uint64_t>(cell[i]) & 15) != CATCH; i = static_cast<uint64_t>(cell[i]) >> 8)
+      continue;
+    if (i == b)
+      throw;
+    sp = q = i;                                 /* unwind the stack to the catch frame first, it may be full */
+    w = cell+q+3;
+    cn = w[2];
+    if (pf)                                     /* the profiled closures and macros return */
+      leave(w[3]);
+    x = cons(atom("ERR"), n);
+    done();
+    r = 1;
+    goto resume;
+  }
+  catch (...) {
+    cn = m;
+    throw;
+  }
+}
+
 /*----------------------------------------------------------------------------*\
  |      PRINT                                                                 |
 \*----------------------------------------------------------------------------*/
@@ -1005,41 +2239,1968 @@ public:
 /* output Lisp expression x */
 void print(L x) {
   if (T(x) == NIL)
-    fprintf(out, "()");
-  else if (T(x) == PRIM)
-    fprintf(out, "<%s>", prim[ord(x)].s);
+    put("()");
+  else if (T(x) == PRIM) {
+    put('<');
+    put(prim[ord(x)].s);
+    put('>');
+  }
   else if (T(x) == ATOM)
-    fprintf(out, "%s", A+ord(x));
-  else if (T(x) == STRG)
-    fprintf(out, "\"%s\"", A+ord(x));
+    put(A+ord(x));
+  else if (T(x) == STRG) {
+    put('"');
+    put(A+ord(x));
+    put('"');
+  }
   else if (T(x) == CONS)
     printlist(x);
-  else if (T(x) == CLOS)
-    fprintf(out, "{%u}", ord(x));
-  else if (T(x) == MACR)
-    fprintf(out, "[%u]", ord(x));
-  else
-    fprintf(out, FLOAT, x);
+  else if (T(x) == FUTR) {
+    if (equ(CDR(x), tru))                       /* a future that was touched prints as its value */
+      print(CAR(x));
+    else
+      put("<future>");
+  }
+  else if (T(x) == PROM)                        /* a promise may be forced to itself, so it does not print its value */
+    put("<promise>");
+  else if (T(x) == CLOS || T(x) == MACR) {
+    char s[16];
+    put(T(x) == CLOS ? '{' : '[');
+    put(s, std::to_chars(s, s+sizeof(s), ord(x)).ptr-s);
+    put(T(x) == CLOS ? '}' : ']');
+  }
+  else {
+    char s[32];
+    put(s, format(s, x));
+  }
+}
+
+/* flush the output buffer to the file it was written for, must be called before closing or writing to that file */
+void flush() {
+  if (on)
+    fwrite(ob, 1, on, of);
+  on = 0;
+}
+
+/* output character c */
+void put(char c) {
+  if (on >= sizeof(ob) || of != out) {          /* if the buffer is full or we switched to another output file */
+    flush();
+    of = out;
+  }
+  ob[on++] = c;
+}
+
+/* output n characters of s */
+void put(const char *s, size_t n) {
+  if (on+n > sizeof(ob) || of != out) {         /* if the buffer has insufficient space or we switched files */
+    flush();
+    of = out;
+    if (n > sizeof(ob)) {                       /* write large strings directly */
+      fwrite(s, 1, n, of);
+      return;
+    }
+  }
+  memcpy(ob+on, s, n);
+  on += n;
+}
+
+/* output string s */
+void put(const char *s) {
+  put(s, strlen(s));
+}
+
+/* format number n in s[] with at least 32 bytes, using the shortest form that reads back as n, returns length */
+static I format(char *s, L n) {
+  return std::to_chars(s, s+32, n).ptr-s;
 }
 
 protected:
 
+/* output buffer ob[] holds on characters to write to file of */
+char ob[4096];
+I on;
+FILE *of;
+
 /* output Lisp list t */
 void printlist(L t) {
-  putc('(', out);
+  put('(');
   while (1) {
     print(car(t));
     t = cdr(t);
     if (T(t) == NIL)
       break;
     if (T(t) != CONS) {
-      fprintf(out, " . ");
+      put(" . ");
       print(t);
       break;
     }
-    putc(' ', out);
+    put(' ');
+  }
+  put(')');
+}
+
+/*----------------------------------------------------------------------------*\
+ |      SERIALIZATION                                                         |
+\*----------------------------------------------------------------------------*/
+
+/* the serialized form of a Lisp expression x is a compact binary string without \0 bytes, bytes 0 and 1 are escaped
+   as 1 followed by 1 and 2, respectively.  Unsigned integers u are variable-length encoded with 7 bits per byte:
+        L u1 u2 u3 <u3 symbols>    header with the number of pairs u1, the heap bytes u2 and the number of symbols u3
+        u <u bytes>                a symbol name in the header or a string, indexed by their order in the header
+   followed by the serialized expression x:
+        n                          () nil
+        i u                        an integer value up to 2^53 encoded with zigzag to map negative values to odd u
+        d <8 bytes>                a double in IEEE 754 little endian order
+        a u                        the u'th symbol in the header
+        s u <u bytes>              a string
+        p u                        the u'th primitive
+        c x y                      a cons pair (x . y), where y is serialized in a loop to avoid recursion
+        C x y                      a closure pair
+        M x y                      a macro pair
+        P x y                      a promise pair ((f . args) . ()) not yet forced or (value . #t) when forced
+        S c|C|M|P x y              a pair that is shared, which is numbered by its order of appearance
+        r u                        a reference to the u'th shared pair
+        F u                        a future u that is not yet touched, a touched future is serialized as its value
+        g                          a reference to the global environment of the Lisp instance that deserializes */
+
+public:
+
+/* serialize x into a compact binary string, references to the global environment are not serialized unless g=0, or
+   serialized as references to cdr(x) when g=2, e.g. to the bindings of the global environment returned by globals() */
+std::string serialize(L x, I g = 1) {
+  L e;
+  memset(used, 0, sizeof(used));                /* use the used[] bits to find pairs we visit more than once */
+  sc = sb = sn = 0;
+  sh.clear();
+  sy.clear();
+  ss.clear();
+  sf.clear();
+  if (g)                                        /* mark the global environment pairs as references to the global env */
+    for (e = env; T(e) == CONS && !(used[ord(e)/64] & 1 << ord(e)/2%32); e = CDR(e)) {
+      used[ord(e)/64] |= 1 << ord(e)/2%32;
+      sh[ord(e)] = ~0;
+    }
+  walk(x);                                      /* count pairs, heap bytes, shared pairs, and collect the symbols */
+  sm = g;
+  sr = g == 2 ? cdr(x) : nil;
+  if (T(sr) == CONS)                            /* cdr(x) is shared when the global environment is referenced */
+    sh.emplace(ord(sr), 0);
+  so.clear();
+  so += 'L';
+  emitn(sc);
+  emitn(sb);
+  emitn(ss.size());
+  for (I i : ss)
+    emits(A+i);
+  emitx(x);
+  return so;
+}
+
+/* deserialize s in one pass into the pool and heap after checking that sufficient space is available, returns x */
+L deserialize(std::string_view s) {
+  I i, n, nc, nb;
+  dp = s.data();
+  de = dp+s.size();
+  if (next() != 'L')
+    ERR(8, "not serialized ");
+  nc = nextn();
+  nb = nextn();
+  n = nextn();
+  if (nc > conses || nb > bytes)                /* cons or heap limit */
+    err(nc > conses ? 11 : 12);
+  conses -= nc;
+  bytes -= nb;
+  if (!avail(nc) && (gc() < 2*nc+2 || !avail(nc)))
+    err(7);
+  if (hp+nb > E && (gc(), hp+nb > E))
+    err(7);
+  dn = nc;
+  dh = hp+nb;
+  ds.clear();
+  dr.clear();
+  dv.clear();
+  dm.clear();
+  df.clear();
+  for (i = 0; i < n; ++i)                       /* collect the symbols in the header */
+    dv.emplace_back(nexts());
+  for (i = 0; i < n; ++i)
+    dm.emplace(dv[i], i);
+  ds.assign(n, 0);
+  for (i = H+R; i < hp && dm.size(); i += strlen(A+i)+R+1) { /* intern the symbols with one pass over the heap */
+    auto k = dm.find(std::string_view(A+i));
+    if (k != dm.end()) {
+      ds[k->second] = box(ATOM, i);
+      dm.erase(k);
+    }
+  }
+  for (i = 0; i < n; ++i)                       /* add the symbols that are new to the heap */
+    if (dm.count(dv[i]))
+      ds[i] = box(ATOM, heap(dv[i]));
+  L x = nextx();
+  if (pool && !df.empty())                      /* keep track of the futures deserialized */
+    adopt();
+  return x;
+}
+
+protected:
+
+/* serializer state: pairs sc, heap bytes sb, shared pairs sn, shared pair numbers sh, symbol numbers sy, symbols ss,
+   the futures sf that were serialized, and the mode g as sm with the replacement sr of the global environment */
+I sc, sb, sn, sm;
+L sr;
+std::unordered_map<I,I> sh, sy;
+std::vector<I> ss, sf;
+std::string so, dt;
+
+/* deserializer state: input [dp,de), pairs dn and heap limit dh remaining, the symbols ds and shared pairs dr, the
+   symbol names dv with their numbers dm that are not yet interned, and the pairs df of the futures deserialized */
+const char *dp, *de;
+I dn, dh;
+std::vector<L> ds, dr;
+std::vector<I> df;
+std::vector<std::string> dv;
+std::unordered_map<std::string_view,I> dm;
+
+/* serializer pass 1 to count pairs and heap bytes of x, find pairs that are shared, and collect symbols */
+void walk(L x) {
+  while (pairs(x)) {
+    I i = ord(x);
+    if (T(x) == FUTR) {                         /* a future is serialized as its value or as a future not yet touched */
+      if (!equ(cell[i+1], tru)) {
+        ++sc;
+        return;
+      }
+      x = cell[i];
+      continue;
+    }
+    if (used[i/64] & 1 << i/2%32) {             /* if we visited this pair before, then it is shared */
+      sh.emplace(i, 0);
+      return;
+    }
+    used[i/64] |= 1 << i/2%32;
+    ++sc;
+    walk(cell[i]);
+    x = cell[i+1];
+  }
+  if (T(x) == ATOM && sy.emplace(ord(x), ss.size()).second) {
+    ss.push_back(ord(x));
+    sb += strlen(A+ord(x))+R+1;
+  }
+  else if (T(x) == STRG)
+    sb += strlen(A+ord(x))+R+1;
+}
+
+/* return the list of the bindings of the global environment that x refers to, directly or through the values of
+   these bindings, in the order of the global environment, to copy x with the global definitions it uses */
+L globals(L x) {
+  std::unordered_set<I> t;
+  std::vector<I> v;
+  L e, *q;
+  size_t n;
+  memset(used, 0, sizeof(used));                /* use the used[] bits to visit each pair once */
+  for (e = env; T(e) == CONS && !(used[ord(e)/64] & 1 << ord(e)/2%32); e = CDR(e))
+    used[ord(e)/64] |= 1 << ord(e)/2%32;        /* the pairs of the global environment are not visited */
+  refs(x, t);
+  do {                                          /* add the symbols the values of the bindings of the symbols refer to */
+    n = t.size();
+    for (e = env; T(e) == CONS; e = CDR(e))
+      if (T(CAR(e)) == CONS && T(CAR(CAR(e))) == ATOM && t.count(ord(CAR(CAR(e)))))
+        refs(CAR(e), t);
+  } while (t.size() > n);
+  for (e = env; T(e) == CONS; e = CDR(e))
+    if (T(CAR(e)) == CONS && T(CAR(CAR(e))) == ATOM && t.count(ord(CAR(CAR(e)))))
+      v.push_back(ord(CAR(e)));
+  q = push(nil);                                /* list the bindings, GC may run, the pairs in v are in use */
+  for (I i : v) {
+    *q = cons(box(CONS, i), nil);
+    q = &CDR(*q);
+  }
+  return pop();
+}
+
+/* add the symbols that x refers to to t, without visiting the pairs that are marked in used[] */
+void refs(L x, std::unordered_set<I>& t) {
+  while (pairs(x)) {
+    I i = ord(x);
+    if (T(x) == FUTR) {                         /* a future not yet touched is evaluated with its own globals */
+      if (!equ(cell[i+1], tru))
+        return;
+      x = cell[i];
+      continue;
+    }
+    if (used[i/64] & 1 << i/2%32)
+      return;
+    used[i/64] |= 1 << i/2%32;
+    refs(cell[i], t);
+    x = cell[i+1];
+  }
+  if (T(x) == ATOM)
+    t.insert(ord(x));
+}
+
+/* serialize byte c, escaping bytes 0 and 1 */
+void emit(char c) {
+  if (static_cast<unsigned char>(c) <= 1) {
+    so += '\1';
+    ++c;
+  }
+  so += c;
+}
+
+/* serialize unsigned integer u with 7 bits per byte */
+void emitn(uint64_t u) {
+  for (; u >= 128; u >>= 7)
+    emit(static_cast<char>(u | 128));
+  emit(static_cast<char>(u));
+}
+
+/* serialize string s */
+void emits(const char *s) {
+  I n = strlen(s);
+  emitn(static_cast<uint64_t>(n));
+  while (n--)
+    emit(*s++);
+}
+
+/* serializer pass 2 to serialize x */
+void emitx(L x) {
+  while (pairs(x)) {
+    I i = ord(x);
+    if (T(x) == FUTR) {
+      if (!equ(cell[i+1], tru)) {
+        emit('F');
+        emitn(static_cast<uint64_t>(cell[i]));
+        sf.push_back(static_cast<I>(cell[i]));
+        return;
+      }
+      x = cell[i];
+      continue;
+    }
+    if (!sh.empty()) {                          /* if there are shared pairs, check if this pair is shared */
+      auto k = sh.find(i);
+      if (k != sh.end()) {
+        if (k->second == ~0U) {
+          if (sm == 2)
+            emitx(sr);
+          else
+            emit('g');
+          return;
+        }
+        if (k->second) {
+          emit('r');
+          emitn(static_cast<uint64_t>(k->second-1));
+          return;
+        }
+        k->second = ++sn;
+        emit('S');
+      }
+    }
+    emit(T(x) == CONS ? 'c' : T(x) == CLOS ? 'C' : T(x) == MACR ? 'M' : 'P');
+    emitx(cell[i]);
+    x = cell[i+1];
+  }
+  if (T(x) == NIL)
+    emit('n');
+  else if (T(x) == ATOM) {
+    emit('a');
+    emitn(static_cast<uint64_t>(sy[ord(x)]));
+  }
+  else if (T(x) == STRG) {
+    emit('s');
+    emits(A+ord(x));
+  }
+  else if (T(x) == PRIM) {
+    emit('p');
+    emitn(static_cast<uint64_t>(ord(x)));
+  }
+  else if (x > -9007199254740992.0 && x < 9007199254740992.0 && equ(x, static_cast<int64_t>(x))) {
+    int64_t n = static_cast<int64_t>(x);
+    emit('i');
+    emitn(static_cast<uint64_t>(n) << 1 ^ static_cast<uint64_t>(n >> 63));
+  }
+  else {
+    uint64_t u = *reinterpret_cast<uint64_t*>(&x);
+    emit('d');
+    for (int k = 0; k < 8; ++k, u >>= 8)
+      emit(static_cast<char>(u));
+  }
+}
+
+/* return nonzero if n+1 pairs are free in the pool, i.e. n pairs can be used without running out of free pairs */
+I avail(I n) {
+  I i = fp;
+  if (!i)
+    return 0;
+  while (n--)
+    if (!(i = ord(cell[i])))
+      return 0;
+  return 1;
+}
+
+/* deserialize the next byte */
+char next() {
+  char c;
+  if (dp >= de)
+    ERR(8, "serialized data ends ");
+  if ((c = *dp++) == 1) {
+    if (dp >= de)
+      ERR(8, "serialized data ends ");
+    c = *dp++-1;
+  }
+  return c;
+}
+
+/* deserialize an unsigned integer */
+uint64_t nextn() {
+  uint64_t u = 0;
+  char c;
+  int k = 0;
+  do {
+    c = next();
+    u |= static_cast<uint64_t>(c & 127) << k;
+    k += 7;
+  } while (c & 128 && k < 64);
+  return u;
+}
+
+/* deserialize a symbol name or a string into dt, returns its characters */
+std::string_view nexts() {
+  uint64_t n = nextn();
+  if (n > static_cast<uint64_t>(de-dp))
+    ERR(8, "serialized data ends ");
+  dt.clear();
+  while (n--)
+    if (!(dt += next()).back())
+      ERR(8, "serialized \\0 ");
+  return dt;
+}
+
+/* copy a deserialized symbol name or string to the heap within the space reserved, returns heap offset */
+I heap(std::string_view v) {
+  I i = hp+R;
+  if (hp+v.size()+R+1 > dh)
+    ERR(8, "serialized heap size ");
+  memcpy(A+i, v.data(), v.size());
+  A[i+v.size()] = 0;
+  hp += v.size()+R+1;
+  return i;
+}
+
+/* deserialize a Lisp expression, the space for pairs was reserved and we pop pairs from the free list */
+L nextx() {
+  L x, *p = &x;
+  while (1) {
+    char c = next();
+    I shared = c == 'S';
+    if (shared)
+      c = next();
+    if (c == 'c' || c == 'C' || c == 'M' || c == 'P') {
+      I i = fp;
+      if (!dn--)
+        ERR(8, "serialized pairs ");
+      fp = ord(cell[i]);                        /* pop the free pair */
+      if (pf & 4)
+        site(i, 0);
+      *p = box(c == 'c' ? CONS : c == 'C' ? CLOS : c == 'M' ? MACR : PROM, i);
+      if (shared)
+        dr.push_back(*p);
+      cell[i+1] = nil;
+      cell[i] = nextx();                        /* deserialize the car */
+      p = &cell[i+1];                           /* then continue to deserialize the cdr */
+      continue;
+    }
+    if (shared)
+      ERR(8, "serialized pair ");
+    switch (c) {
+      case 'n':
+        *p = nil;
+        break;
+      case 'i': {
+        uint64_t u = nextn();
+        *p = static_cast<int64_t>(u >> 1 ^ -(u & 1));
+        break;
+      }
+      case 'd': {
+        uint64_t u = 0;
+        for (int k = 0; k < 64; k += 8)
+          u |= static_cast<uint64_t>(static_cast<unsigned char>(next())) << k;
+        *p = *reinterpret_cast<L*>(&u);
+        break;
+      }
+      case 'a': {
+        uint64_t u = nextn();
+        *p = u < ds.size() ? ds[u] : ERR(8, "serialized symbol ");
+        break;
+      }
+      case 's':
+        *p = box(STRG, heap(nexts()));
+        break;
+      case 'p': {
+        uint64_t u = nextn();
+        *p = u < sizeof(prim)/sizeof(*prim)-1 ? box(PRIM, u) : ERR(8, "serialized primitive ");
+        break;
+      }
+      case 'r': {
+        uint64_t u = nextn();
+        *p = u < dr.size() ? dr[u] : ERR(8, "serialized reference ");
+        break;
+      }
+      case 'g':
+        *p = env;
+        break;
+      case 'F': {
+        I i = fp;
+        if (!dn--)
+          ERR(8, "serialized pairs ");
+        fp = ord(cell[i]);
+        if (pf & 4)
+          site(i, 0);
+        cell[i] = static_cast<L>(nextn());      /* the number of the future in the pool */
+        cell[i+1] = nil;
+        *p = box(FUTR, i);
+        df.push_back(i);
+        break;
+      }
+      default:
+        ERR(8, "serialized data ");
+    }
+    return x;
+  }
+}
+
+/*----------------------------------------------------------------------------*\
+ |      PARALLEL MAP AND REDUCE                                               |
+\*----------------------------------------------------------------------------*/
+
+public:
+
+/* the number of worker interpreters of pmap and preduce, the number of cores by default, 0 evaluates sequentially */
+I workers;
+
+/* apply f to the list of arguments t, returns the value, f must be protected from getting GC'ed by the caller */
+L apply(L f, L t) {
+  L *p = push(application(f, t)), y = eval(*p, env);
+  unwind(sp+1);
+  return y;
+}
+
+/* return the expression (f (quote x1) ... (quote xk)) that applies f to the list of arguments t = (x1 ... xk) */
+L application(L f, L t) {
+  L *p = push(t), *x = push(cons(f, nil)), *q = &CDR(*x), y;
+  for (y = *p; T(y) == CONS; y = *p = cdr(y)) {
+    *q = cons(cons(box(PRIM, 2), cons(car(y), nil)), nil); /* add (quote <arg>) to the end of the list, prim[2] is quote */
+    q = &CDR(*q);
+  }
+  y = *x;
+  unwind(sp+2);
+  return y;
+}
+
+protected:
+
+/* pool of worker threads, each with its own interpreter and a deque of jobs to take from the front or steal from the
+   back, a job is a serialized part of the list, and all workers share the serialized function with its global bindings */
+struct Pool {
+  std::vector<std::thread> th;
+  std::vector<This*> lisp;
+  std::vector<std::deque<I>> dq;
+  std::unique_ptr<std::mutex[]> qm;
+  std::mutex m;
+  std::condition_variable go, done;
+  I gen = 0, busy = 0, quit = 0, mode = 0;
+  int err = 0;
+  std::string fe;
+  std::chrono::steady_clock::time_point due;    /* the deadline of the jobs, the deadline of the caller */
+  uint64_t lim[3];                              /* the fuel, cons and heap limits of the jobs, those of the caller */
+  uint64_t use[3] = {};                         /* the limits used by the workers, to charge to the owner */
+  std::vector<std::string> jobs, res;
+  std::vector<I> rf;                            /* the futures the serialized results refer to until deserialized */
+  This *owner;
+  struct Future {
+    std::string task, res;                      /* the serialized thunk with its global bindings and its value */
+    int err = 0;                                /* the error code when the evaluation of the future failed */
+    I done = 0;
+    std::chrono::steady_clock::time_point due;  /* the deadline of the evaluation, the deadline of future's caller */
+    uint64_t lim[3];                            /* the fuel, cons and heap limits of the evaluation, those of the caller */
+    I refs = 0;                                 /* the number of tasks and serialized values that refer to the future */
+    std::vector<I> pairs;                       /* the pairs of the future in the owner's pool that are not yet touched */
+    std::vector<I> deps;                        /* the futures the task refers to, or the value refers to when done */
+  };
+  std::unordered_map<I,Future> fs;             /* the futures by number, released when done and no longer referenced */
+  std::deque<I> fq;                             /* the queue of futures to evaluate */
+  I fn = 0;                                     /* the next future number */
+  std::condition_variable fd;                   /* signals that a future is done */
+};
+Pool *pool;
+
+/* map (mode 0) or reduce (mode 1) the list s with f, splitting s into jobs for the workers, a reduction of the list s
+   starts with the car of s to reduce the rest of the list, assuming f is associative to reduce the jobs in parallel,
+   f and s must be protected from getting GC'ed by the caller */
+L parallel(L f, L s, I mode) {
+  I i, n, k = sp;
+  L *p = push(f), *h = push(s), *r = h, x, y, z;
+  for (n = 0, x = s; T(x) == CONS; x = cdr(x))
+    ++n;
+  if (workers == 0 || n < 2+mode) {             /* evaluate sequentially without workers or when too short */
+    x = job(f, s, mode);
+    unwind(k);
+    return x;
+  }
+  start();
+  Pool& w = *pool;
+  *h = nil;
+  I m = w.lisp.size(), c = (n+4*m-1)/(4*m);     /* split the list into about 4 jobs per worker */
+  w.jobs.clear();
+  for (x = s; T(x) == CONS; x = z) {            /* serialize each part of c elements of the list by cutting it */
+    for (y = x, i = 1; i < c && (z = CDR(y), T(z) == CONS); ++i)
+      y = z;
+    z = CDR(y);
+    CDR(y) = nil;
+    w.jobs.push_back(serialize(x));
+    CDR(y) = z;
+  }
+  *h = globals(*p);
+  w.fe = serialize(cons(*p, *h), 2);            /* serialize f together with the global bindings it uses */
+  *h = nil;
+  w.res.assign(w.jobs.size(), std::string());
+  for (i = 0; i < m; ++i) {                     /* drop the jobs left over when the workers stopped at an error */
+    std::lock_guard<std::mutex> l(w.qm[i]);
+    w.dq[i].clear();
+  }
+  for (i = 0; i < w.jobs.size(); ++i)           /* give each worker its share of consecutive jobs */
+    w.dq[i*m/w.jobs.size()].push_back(i);
+  {
+    std::lock_guard<std::mutex> l(w.m);
+    w.mode = mode;
+    w.err = 0;
+    w.due = due;
+    w.lim[0] = fuel;
+    w.lim[1] = conses;
+    w.lim[2] = bytes;
+    w.busy = m;
+    ++w.gen;
+  }
+  w.go.notify_all();
+  {
+    std::unique_lock<std::mutex> l(w.m);
+    int b = 0;
+    while (w.busy && !(b = pause(l, w.done))) /* wait for the workers, unless interrupted or past the deadline */
+      continue;
+    if (w.busy) {
+      for (i = 0; i < m; ++i) {                 /* drop the jobs not yet taken */
+        std::lock_guard<std::mutex> q(w.qm[i]);
+        w.dq[i].clear();
+      }
+      while (w.busy) {                          /* break the jobs of the workers and wait until they stopped */
+        for (auto q : w.lisp)
+          q->interrupt();
+        w.done.wait_for(l, std::chrono::milliseconds(10));
+      }
+      drop(w.rf);
+      w.rf.clear();
+      l.unlock();
+      charge();
+      err(b);
+    }
+  }
+  charge();                                     /* charge the limits used by the workers */
+  for (i = 0; i < w.res.size() && !w.err; ++i) { /* concatenate the mapped parts or list the reduced parts */
+    *r = x = deserialize(w.res[i]);
+    if (mode)
+      r = &CDR(*r = cons(x, nil));
+    else
+      while (T(x) == CONS) {
+        r = &CDR(x);
+        x = *r;
+      }
+  }
+  {
+    std::lock_guard<std::mutex> l(w.m);
+    drop(w.rf);                                 /* the results no longer hold the futures they refer to */
+    w.rf.clear();
+  }
+  if (w.err)
+    err(w.err);
+  x = mode ? job(*p, *h, 1) : *h;               /* reduce the reduced parts */
+  unwind(k);
+  return x;
+}
+
+/* map (mode 0) or reduce (mode 1) the list t with f, returns the list of values or the reduced value, f must be
+   protected from getting GC'ed by the caller */
+L job(L f, L t, I mode) {
+  L *q = push(t), *p = push(f), *x = push(nil), *r = push(nil), y;
+  if (mode) {
+    *x = car(*q);
+    for (y = *q = cdr(*q); T(y) == CONS; y = *q = cdr(y)) {
+      *r = cons(car(y), nil);
+      *r = cons(*x, *r);
+      *x = apply(*p, *r);                       /* (f x y) */
+    }
+  }
+  else {
+    for (r = x, y = *q; T(y) == CONS; y = *q = cdr(y)) {
+      *r = cons(apply(*p, cons(car(y), nil)), nil);
+      r = &CDR(*r);
+    }
+  }
+  y = *x;
+  unwind(sp+4);
+  return y;
+}
+
+/* start the pool of workers, unless started */
+void start() {
+  if (pool)
+    return;
+  pool = new Pool;
+  pool->owner = this;
+  pool->dq.resize(workers);
+  pool->qm.reset(new std::mutex[workers]);
+  for (I i = 0; i < workers; ++i) {
+    pool->lisp.push_back(new This);
+    pool->lisp[i]->batch = 1;                   /* workers never read the terminal */
+    pool->lisp[i]->workers = 0;                 /* workers evaluate pmap, preduce and future sequentially */
+    pool->lisp[i]->pool = pool;                 /* workers touch the futures of the pool */
+  }
+  for (I i = 0; i < workers; ++i)
+    pool->th.emplace_back(&This::work, this, i);
+}
+
+/* stop the pool of workers, if started */
+void stop() {
+  if (!pool)
+    return;
+  {
+    std::lock_guard<std::mutex> l(pool->m);
+    pool->quit = 1;
+  }
+  pool->go.notify_all();
+  for (auto l : pool->lisp)                     /* break the evaluations that are still running */
+    l->interrupt();
+  for (auto& t : pool->th)
+    t.join();
+  for (auto l : pool->lisp) {
+    l->pool = NULL;
+    delete l;
+  }
+  delete pool;
+  pool = NULL;
+}
+
+/* take job j from the front of the deque of worker k or steal one from the back of another worker's deque */
+I take(I k, I& j) {
+  Pool& w = *pool;
+  for (I i = 0, n = w.dq.size(); i < n; ++i) {
+    I v = (k+i)%n;
+    std::lock_guard<std::mutex> l(w.qm[v]);
+    if (!w.dq[v].empty()) {
+      j = i ? w.dq[v].back() : w.dq[v].front();
+      i ? w.dq[v].pop_back() : w.dq[v].pop_front();
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* the thread of worker k runs the jobs of each parallel map or reduce until the pool stops */
+void work(I k) {
+  Pool& w = *pool;
+  This& lisp = *w.lisp[k];
+  I g = 0, j;
+#ifdef HAVE_SIGNAL_H
+  sigset_t m;
+  sigemptyset(&m);
+  sigaddset(&m, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &m, NULL);         /* CTRL-C is for the REPL thread */
+#endif
+  while (1) {
+    I f = 0;
+    {
+      std::unique_lock<std::mutex> l(w.m);
+      w.go.wait(l, [&w, g] { return w.quit || w.gen != g || !w.fq.empty(); });
+      if (w.quit)
+        return;
+      if (!w.fq.empty()) {                      /* evaluate a queued future first */
+        j = w.fq.front();
+        w.fq.pop_front();
+        f = 1;
+      }
+      else
+        g = w.gen;
+    }
+    if (f) {
+      lisp.task(j);
+      continue;
+    }
+    int n = 0;
+    lisp.irq.fetch_and(~1U);                    /* forget the interrupt of the jobs of a previous parallel map */
+    lisp.due = w.due;
+    lisp.tk = 1;
+    lisp.limit(w.lim);
+    try {
+      lisp.unwind();
+      L *f = lisp.push(lisp.deserialize(w.fe)); /* f with the global bindings of the caller it uses */
+      lisp.env = lisp.cdr(*f);
+      *f = lisp.car(*f);
+      lisp.limit(w.lim);                        /* the copy of the global bindings is not charged */
+      while (take(k, j)) {
+        w.res[j] = lisp.serialize(lisp.job(*f, lisp.deserialize(w.jobs[j]), w.mode));
+        std::lock_guard<std::mutex> l(w.m);
+        lisp.hold(lisp.sf);                     /* the result holds the futures it refers to */
+        w.rf.insert(w.rf.end(), lisp.sf.begin(), lisp.sf.end());
+      }
+    }
+    catch (int i) {
+      n = i;
+    }
+    catch (...) {
+      n = 5;
+    }
+    lisp.unwind();
+    std::lock_guard<std::mutex> l(w.m);
+    lisp.drop(lisp.held);                       /* the futures copied to the worker by the jobs are no longer used */
+    lisp.held.clear();
+    lisp.spent(w.lim);
+    if (n && !w.err)
+      w.err = n;
+    if (!--w.busy)
+      w.done.notify_one();
+  }
+}
+
+/*----------------------------------------------------------------------------*\
+ |      FUTURES                                                               |
+\*----------------------------------------------------------------------------*/
+
+public:
+
+/* return a future to evaluate x in environment e by a worker, x and e are copied to the worker together with the
+   bindings of the global environment they refer to */
+L future(L x, L e) {
+  L *p = push(closure(nil, x, e)), *q = push(nil);
+  start();
+  Pool& w = *pool;
+  if (w.owner == this)
+    charge();                                   /* charge the limits used by the workers so far */
+  *q = globals(*p);
+  std::string s = serialize(cons(*p, *q), 2);   /* serialize the thunk together with the global bindings it uses */
+  std::vector<I> d = sf;                        /* the futures the thunk and the global bindings refer to */
+  *q = cons(nil, nil);                          /* the future is a pair (u . ()) until touched, then (value . #t) */
+  {
+    std::lock_guard<std::mutex> l(w.m);
+    I u = w.fn++;
+    auto& f = w.fs[u];
+    f.task = std::move(s);
+    f.due = due;
+    f.lim[0] = fuel;
+    f.lim[1] = conses;
+    f.lim[2] = bytes;
+    f.deps = std::move(d);
+    hold(f.deps);
+    if (w.owner == this)                        /* the owner's pair refers to the future until touched or collected */
+      f.pairs.push_back(ord(*q));
+    else {                                      /* the worker's pair refers to it until the task of the worker ends */
+      held.push_back(u);
+      ++f.refs;
+    }
+    w.fq.push_back(u);
+    CAR(*q) = u;
+  }
+  w.go.notify_one();
+  x = box(FUTR, ord(*q));
+  unwind(sp+2);
+  return x;
+}
+
+/* return the value of future x, waits until a worker is done or evaluates it when no worker took it yet */
+L touch(L x) {
+  std::string s;
+  int n;
+  if (T(x) != FUTR)                             /* touching a value that is not a future returns the value */
+    return x;
+  if (equ(CDR(x), tru))                         /* the future was touched before */
+    return CAR(x);
+  I u = CAR(x);
+  if (!pool)                                    /* the future was deserialized in an interpreter without the pool */
+    err(5);
+  Pool& w = *pool;
+  L *p = push(x);                               /* keep the future while waiting, so GC does not release it */
+  {
+    std::unique_lock<std::mutex> l(w.m);
+    while (1) {
+      auto k = w.fs.find(u);
+      if (k == w.fs.end())
+        err(5);
+      if (k->second.done) {
+        s = k->second.res;
+        n = k->second.err;
+        break;
+      }
+      I v = u;
+      auto q = std::find(w.fq.begin(), w.fq.end(), u);
+      if (q != w.fq.end())                      /* steal the future from the queue to evaluate it now */
+        w.fq.erase(q);
+      else if (!w.fq.empty()) {                 /* or help by evaluating another future while waiting */
+        v = w.fq.front();
+        w.fq.pop_front();
+      }
+      else if ((n = pause(l, w.fd))) {          /* wait for the future, unless interrupted or past the deadline */
+        for (auto z : w.lisp)                   /* then break the evaluation of the futures by the workers */
+          z->interrupt();
+        l.unlock();
+        err(n);
+      }
+      else
+        continue;
+      l.unlock();
+      task(v);
+      l.lock();
+    }
+  }
+  if (w.owner == this)
+    charge();                                   /* charge the limits used by the workers */
+  if (n)                                        /* the evaluation of the future raised error n */
+    err(n);
+  L y = deserialize(s);
+  CAR(*p) = y;                                  /* the future is touched, its value replaces the future number */
+  CDR(*p) = tru;
+  unwind(sp+1);
+  if (w.owner == this) {                        /* the pair no longer refers to the future, release it if unused */
+    std::lock_guard<std::mutex> l(w.m);
+    auto k = w.fs.find(u);
+    if (k != w.fs.end()) {
+      auto& v = k->second.pairs;
+      v.erase(std::remove(v.begin(), v.end(), ord(x)), v.end());
+      reap(u);
+    }
+  }
+  return y;
+}
+
+protected:
+
+/* the futures referred to by the pairs in this worker, released when its task or jobs end */
+std::vector<I> held;
+
+/* hold the futures t, the pool lock must be held */
+void hold(const std::vector<I>& t) {
+  for (I u : t) {
+    auto k = pool->fs.find(u);
+    if (k != pool->fs.end())
+      ++k->second.refs;
+  }
+}
+
+/* drop the futures t held before and release the futures no longer used, the pool lock must be held */
+void drop(std::vector<I> t) {
+  while (!t.empty()) {
+    auto k = pool->fs.find(t.back());
+    t.pop_back();
+    if (k != pool->fs.end() && !--k->second.refs && k->second.done && k->second.pairs.empty()) {
+      t.insert(t.end(), k->second.deps.begin(), k->second.deps.end());
+      pool->fs.erase(k);
+    }
+  }
+}
+
+/* release future u if it is done and no longer used, the pool lock must be held */
+void reap(I u) {
+  auto k = pool->fs.find(u);
+  if (k != pool->fs.end() && !k->second.refs && k->second.done && k->second.pairs.empty()) {
+    std::vector<I> t;
+    t.swap(k->second.deps);
+    pool->fs.erase(k);
+    drop(std::move(t));
+  }
+}
+
+/* set the fuel, cons and heap limits of this worker to t */
+void limit(const uint64_t *t) {
+  fuel = t[0];
+  conses = t[1];
+  bytes = t[2];
+}
+
+/* add the limits used by this worker since set to t to the usage of the pool, the pool lock must be held */
+void spent(const uint64_t *t) {
+  pool->use[0] += t[0]-fuel;
+  pool->use[1] += t[1]-conses;
+  pool->use[2] += t[2]-bytes;
+}
+
+/* charge the limits used by the workers to the owner, raises err(10), err(11) or err(12) when a limit is exceeded */
+void charge() {
+  uint64_t u[3], *t[3] = { &fuel, &conses, &bytes };
+  {
+    std::lock_guard<std::mutex> l(pool->m);
+    memcpy(u, pool->use, sizeof(u));
+    memset(pool->use, 0, sizeof(pool->use));
+  }
+  int n = 0;
+  for (int k = 0; k < 3; ++k)
+    if (*t[k] != ~0ULL) {                       /* an unlimited limit stays unlimited */
+      if (u[k] > *t[k]) {
+        *t[k] = 0;
+        if (!n)
+          n = 10+k;
+      }
+      else
+        *t[k] -= u[k];
+    }
+  if (n)
+    err(n);
+}
+
+/* the pairs deserialized by this interpreter refer to futures: the owner keeps track of its pairs to release the
+   futures when their pairs are collected, a worker holds the futures until its task or jobs end */
+void adopt() {
+  std::lock_guard<std::mutex> l(pool->m);
+  for (I i : df) {
+    auto k = pool->fs.find(static_cast<I>(cell[i]));
+    if (k == pool->fs.end())
+      continue;
+    if (pool->owner == this)
+      k->second.pairs.push_back(i);
+    else {
+      held.push_back(k->first);
+      ++k->second.refs;
+    }
+  }
+}
+
+/* release the futures of the owner whose pairs are no longer used after marking, the pool lock must not be held */
+void prune() {
+  std::vector<I> t;
+  std::lock_guard<std::mutex> l(pool->m);
+  for (auto& k : pool->fs) {
+    auto& v = k.second.pairs;
+    v.erase(std::remove_if(v.begin(), v.end(), [this](I i) {
+      return !(used[i/64] & 1 << i/2%32) || equ(cell[i+1], tru);
+    }), v.end());
+    if (v.empty())
+      t.push_back(k.first);
+  }
+  for (I u : t)
+    reap(u);
+}
+
+/* evaluate future u of the pool in this interpreter with a copy of the global bindings of the owner it uses */
+void task(I u) {
+  Pool& w = *pool;
+  std::string s;
+  std::vector<I> d, h;
+  int n = 0;
+  I k = sp;
+  L *e = push(env);
+  auto t = due;
+  uint64_t c[3] = { fuel, conses, bytes }, m[3];
+  held.swap(h);                                 /* hold the futures copied by this task apart from an outer task */
+  {
+    std::lock_guard<std::mutex> l(w.m);
+    s = std::move(w.fs[u].task);
+    due = std::min(due, w.fs[u].due);           /* the earliest deadline applies */
+    tk = 1;
+    memcpy(m, w.fs[u].lim, sizeof(m));
+  }
+  if (w.owner != this) {                        /* a worker evaluates with the limits of the caller of future */
+    irq.fetch_and(~1U);                         /* forget the interrupt of a previous future of the worker */
+    limit(m);
+  }
+  ++cn;                                         /* the error of a future is raised again when touched */
+  try {
+    L *f = push(deserialize(s));
+    env = cdr(*f);
+    if (w.owner != this)
+      limit(m);                                 /* the copy of the global bindings is not charged */
+    s = serialize(touch(apply(car(*f), nil)));  /* a future that returns a future returns the value of the latter */
+    d = sf;
+  }
+  catch (int i) {
+    n = i;
+  }
+  catch (...) {
+    n = 5;
+  }
+  --cn;
+  env = *e;
+  due = t;
+  unwind(k);
+  std::lock_guard<std::mutex> l(w.m);
+  if (w.owner != this) {
+    spent(m);
+    limit(c);                                   /* restore the limits of the jobs the worker evaluates, if any */
+  }
+  auto& f = w.fs[u];
+  f.res = std::move(s);
+  f.err = n;
+  f.done = 1;
+  hold(d);                                      /* the value holds the futures it refers to */
+  d.swap(f.deps);
+  drop(std::move(d));                           /* and the task no longer does */
+  drop(held);
+  held.swap(h);
+  reap(u);
+  w.fd.notify_all();
+}
+
+/*----------------------------------------------------------------------------*\
+ |      PROMISES AND STREAMS                                                  |
+\*----------------------------------------------------------------------------*/
+
+public:
+
+/* return a promise to apply f to the arguments of the list t = (f . args) when forced, a promise is a pair
+   ((f . args) . ()) until forced, then (value . #t) */
+L promise(L t) {
+  return box(PROM, ord(cons(t, nil)));
+}
+
+/* return the value of promise x, evaluated once when forced the first time */
+L force(L x) {
+  L y;
+  if (T(x) != PROM)                             /* forcing a value that is not a promise returns the value */
+    return x;
+  y = CDR(x);
+  if (equ(y, tru))                              /* the promise was forced before */
+    return CAR(x);
+  y = CAR(x);
+  L *p = push(x);
+  y = apply(car(y), cdr(y));
+  if (!equ(CDR(*p), tru)) {                     /* the first value is kept when forced again while evaluating */
+    CAR(*p) = y;
+    CDR(*p) = tru;
+  }
+  y = CAR(*p);
+  unwind(sp+1);
+  return y;
+}
+
+protected:
+
+/* return the primitive named s */
+static L primitive(const char *s) {
+  I i = 0;
+  while (strcmp(prim[i].s, s))
+    ++i;
+  return box(PRIM, i);
+}
+
+/*----------------------------------------------------------------------------*\
+ |      INSTRUMENTATION HOOKS                                                 |
+\*----------------------------------------------------------------------------*/
+
+public:
+
+/* the instrumentation hooks */
+Hooks hooks;
+
+/* return the name of closure or macro f, the name it is bound to in its scope or the global env, else "lambda" or
+   "macro", the name is valid until the next garbage collection */
+const char *named(L f) {
+  L e = T(f) == CLOS ? CDR(f) : nil;
+  for (I i = 0; i < 2; ++i, e = env)            /* search the scope of f, then the global env */
+    for (; T(e) == CONS; e = CDR(e))
+      if (T(CAR(e)) == CONS && equ(CDR(CAR(e)), f) && T(CAR(CAR(e))) == ATOM)
+        return A+ord(CAR(CAR(e)));
+  return T(f) == CLOS ? "lambda" : "macro";
+}
+
+protected:
+
+/* closure or macro f is applied */
+void entered(L f) {
+  hooks.enter(*this, f);
+  PROBE1(enter, ord(f));
+}
+
+/* closure or macro f returns */
+void left(L f) {
+  hooks.leave(*this, f);
+  PROBE1(leave, ord(f));
+}
+
+/*----------------------------------------------------------------------------*\
+ |      PROFILER                                                              |
+\*----------------------------------------------------------------------------*/
+
+public:
+
+/* start (on=1) or stop (on=0) profiling the closures and macros applied, starting clears the previous profile unless
+   sampling */
+void profile(I on) {
+  if (on)
+    begin(1);
+  else if (pf & 1) {
+    leave(0);
+    pf &= ~1;
+  }
+}
+
+/* start sampling the chain of closures and macros applied hz times per second, or stop sampling when hz=0, starting
+   clears the previous profile unless profiling */
+void sample(unsigned hz) {
+  if (hz && !(pf & 2)) {
+    begin(2);
+    prof->halt = false;
+    prof->timer = std::thread([this, hz] {      /* request a sample at the next safe point every 1/hz seconds */
+      Prof& w = *prof;
+      std::unique_lock<std::mutex> lock(w.m);
+      while (!w.cv.wait_for(lock, std::chrono::microseconds(1000000/hz), [&w] { return w.halt; }))
+        irq.fetch_or(2, std::memory_order_relaxed);
+    });
+  }
+  else if (!hz && (pf & 2)) {
+    {
+      std::lock_guard<std::mutex> lock(prof->m);
+      prof->halt = true;
+    }
+    prof->cv.notify_one();
+    prof->timer.join();
+    pf &= ~2;
+  }
+}
+
+/* start (on=1) or stop (on=0) tracking the closures and primitives that allocate pairs and atoms/strings, starting
+   clears the previous profile unless profiling or sampling */
+void track(I on) {
+  if (on && !(pf & 4)) {
+    begin(4);
+    prof->as.assign(P/2, ~0U);                  /* the pairs and atoms/strings allocated before are not tracked */
+    for (I i = H; i < hp; i += strlen(A+R+i)+R+1)
+      *(I*)(A+i) = ~0U;
+    ap = 0;
+  }
+  else if (!on)
+    pf &= ~4;
+}
+
+/* garbage collect and return a table of the live objects and bytes by type and, when tracking, by allocation site
+   with the number and bytes of pairs and atoms/strings allocated */
+std::string census() {
+  static const char *types[] = { "cons", "closure", "macro", "future", "atom", "string", "promise" };
+  uint64_t n[7] = {}, b[7] = {};
+  std::unordered_map<I,std::pair<uint64_t,uint64_t>> live;
+  std::vector<char> ty(P/2);
+  std::unordered_map<I,char> ht;
+  std::string s;
+  char buf[160];
+  auto see = [&](L x) {                         /* note the type of the pair or atom/string x refers to */
+    switch (T(x)) {
+      case CLOS: ty[ord(x)/2] = 1; break;
+      case MACR: ty[ord(x)/2] = 2; break;
+      case FUTR: ty[ord(x)/2] = 3; break;
+      case PROM: ty[ord(x)/2] = 6; break;
+      case STRG: ht[ord(x)] = 5; break;
+      case ATOM: ht[ord(x)] = 4; break;
+    }
+  };
+  gc();
+  see(env);
+  for (I i = 0; i < P; ++i)
+    if (used[i/64] & 1 << i/2%32)
+      see(cell[i]);
+  for (I i = sp; i < N; ++i)
+    see(cell[i]);
+  for (I i = 0; i < P/2; ++i)                   /* the pairs in the pool */
+    if (used[i/32] & 1 << i%32) {
+      ++n[static_cast<int>(ty[i])];
+      b[static_cast<int>(ty[i])] += 2*sizeof(L);
+      if (pf & 4) {
+        auto& x = live[prof->as[i]];
+        ++x.first;
+        x.second += 2*sizeof(L);
+      }
+    }
+  for (I i = H; i < hp; i += strlen(A+R+i)+R+1) { /* the atoms and strings on the heap */
+    I k = strlen(A+R+i)+R+1;
+    auto t = ht.find(i+R);
+    int j = t == ht.end() ? 4 : t->second;
+    ++n[j];
+    b[j] += k;
+    if (pf & 4) {
+      auto& x = live[*(I*)(A+i)];
+      ++x.first;
+      x.second += k;
+    }
+  }
+  s = "   objects       bytes  type\n";
+  for (int j = 0; j < 7; ++j) {
+    snprintf(buf, sizeof(buf), "%10llu %11llu  %s\n", static_cast<unsigned long long>(n[j]),
+        static_cast<unsigned long long>(b[j]), types[j]);
+    s += buf;
+  }
+  if (pf & 4) {
+    Prof& w = *prof;
+    std::vector<I> v;
+    for (I i = 0; i < w.na.size(); ++i)
+      if (w.na[i])
+        live[i];
+    for (auto& i : live)
+      v.push_back(i.first);
+    std::sort(v.begin(), v.end(), [&](I i, I j) {
+      return live[i].second > live[j].second || (live[i].second == live[j].second && i < j);
+    });
+    s += "   objects       bytes   allocated  allocated bytes  site\n";
+    for (I i : v) {
+      auto& x = live[i];
+      snprintf(buf, sizeof(buf), "%10llu %11llu %11llu %16llu  %s\n", static_cast<unsigned long long>(x.first),
+          static_cast<unsigned long long>(x.second), static_cast<unsigned long long>(i < w.na.size() ? w.na[i] : 0),
+          static_cast<unsigned long long>(i < w.nb.size() ? w.nb[i] : 0),
+          i < w.names.size() ? w.names[i].c_str() : "(untracked)");
+      s += buf;
+    }
+  }
+  return s;
+}
+
+/* start recording events in a ring buffer of the last n events, rounded up to a power of two, or stop recording when
+   n=0, writes the events to file f when an error is raised that is not caught if f is not NULL, starting clears the
+   previous profile unless profiling, sampling or tracking */
+void record(size_t n, const char *f = NULL) {
+  if (n) {
+    begin(8);
+    Prof& w = *prof;
+    size_t k = 1;
+    while (k < n)
+      k <<= 1;
+    try {
+      w.ev.assign(k, {0, 0, 0});
+    }
+    catch (std::bad_alloc&) {
+      pf &= ~8;
+      err(5);
+    }
+    w.en = 0;
+    w.ef = f ? f : "";
+    w.t0 = std::chrono::steady_clock::now();
+  }
+  else
+    pf &= ~8;
+}
+
+/* return the recorded events in binary format: "LISPTRC1", the closure and macro names, the primitive names and the
+   error messages as tables of 32 bit counts followed by 32 bit lengths and the characters of each string, a 64 bit
+   count of events followed by the 64 bit number of events dropped from the ring buffer, then the events in the order
+   recorded, each a 64 bit time in nanoseconds since recording started, a 32 bit kind and a 32 bit argument:
+   kind 1: a closure or macro is applied, argument is its name
+   kind 2: a closure or macro returns, argument is its name
+   kind 3: a primitive is called, argument is its name
+   kind 4: GC starts, argument is the number of heap bytes in use
+   kind 5: GC ends, argument is the number of free cells in the pool
+   kind 6: an error is raised, argument is the error code and its message */
+std::string events() {
+  std::string s("LISPTRC1");
+  if (!prof)
+    return s;
+  Prof& w = *prof;
+  auto put32 = [&s](uint32_t u) { s.append(reinterpret_cast<const char*>(&u), sizeof(u)); };
+  auto put64 = [&s](uint64_t u) { s.append(reinterpret_cast<const char*>(&u), sizeof(u)); };
+  auto puts = [&](const char *t) { put32(strlen(t)); s += t; };
+  put32(w.names.size());
+  for (auto& t : w.names)
+    puts(t.c_str());
+  put32(sizeof(prim)/sizeof(prim[0]));
+  for (auto& q : prim)
+    puts(q.s ? q.s : "");
+  put32(14);
+  for (int i = 0; i < 14; ++i)
+    puts(error(i));
+  uint64_t k = w.ev.size(), n = std::min(w.en, k);
+  put64(n);
+  put64(w.en - n);
+  for (uint64_t i = w.en - n; i < w.en; ++i) {
+    auto& e = w.ev[i & (k-1)];
+    put64(e.t);
+    put32(e.k);
+    put32(e.a);
+  }
+  return s;
+}
+
+/* return the profile as a table sorted by key "calls", "time" (inclusive), "self" (exclusive) or "conses" */
+std::string report(const char *key = "self") {
+  std::string s;
+  char b[160];
+  if (!prof)
+    return s;
+  Prof& w = *prof;
+  std::vector<I> v;
+  for (auto& i : w.st)
+    v.push_back(i.first);
+  int c = !strcmp(key, "calls") ? 0 : !strcmp(key, "time") ? 1 : !strcmp(key, "conses") ? 3 : 2;
+  std::sort(v.begin(), v.end(), [&](I i, I j) {
+    auto& x = w.st[i];
+    auto& y = w.st[j];
+    uint64_t a = c == 0 ? x.calls : c == 1 ? x.incl : c == 2 ? x.excl : x.cons;
+    uint64_t b = c == 0 ? y.calls : c == 1 ? y.incl : c == 2 ? y.excl : y.cons;
+    return a > b || (a == b && w.names[i] < w.names[j]);
+  });
+  s = "     calls     time ms     self ms      conses  name\n";
+  for (I i : v) {
+    auto& x = w.st[i];
+    snprintf(b, sizeof(b), "%10llu %11.3f %11.3f %11llu  ", static_cast<unsigned long long>(x.calls), x.incl/1e6,
+        x.excl/1e6, static_cast<unsigned long long>(x.cons));
+    s += b;
+    s += w.names[i];
+    s += '\n';
+  }
+  return s;
+}
+
+/* return the profile in folded stacks format for flame graphs, the exclusive time in microseconds of each stack */
+std::string folded() {
+  return prof ? fold(prof->ns, 1000) : std::string();
+}
+
+/* return the samples in folded stacks format for flame graphs, the number of samples of each stack */
+std::string samples() {
+  return prof ? fold(prof->hits, 1) : std::string();
+}
+
+protected:
+
+/* profile of the closures and macros by name: the statistics st, the call tree nodes (parent, name) with exclusive
+   time ns and samples hits, the stack of frames fs applied, the names by closure kc cleared by gc(), the names by
+   number, the sampling timer thread, and when tracking the allocation site of each pair as, the names of the
+   primitives pk, the sites of the atoms/strings saved by compact() hs, and the allocations na and bytes nb by site,
+   and when recording the ring buffer of events ev, the number of events recorded en, the file ef to write to when
+   an error is raised, and the time recording started t0 */
+struct Prof {
+  struct Stat {
+    uint64_t calls = 0, incl = 0, excl = 0, cons = 0;
+    I active = 0;                               /* the number of frames on the stack, to time recursion once */
+  };
+  struct Frame {
+    L f;                                        /* the closure or macro applied */
+    I sp;                                       /* the stack pointer of the step() that applies f */
+    I key, node;                                /* the name of f or ~0, and the call tree node of f when profiling or ~0 */
+    I ap;                                       /* the allocating primitive when f was applied */
+    std::chrono::steady_clock::time_point t;
+    uint64_t child, c, cchild;                  /* the time of children, the cons counter, and conses of children */
+  };
+  std::unordered_map<I,Stat> st;
+  std::vector<std::pair<I,I>> nodes;
+  std::vector<uint64_t> ns, hits;
+  std::unordered_map<uint64_t,I> tree;
+  std::vector<Frame> fs;
+  std::unordered_map<I,I> kc;
+  std::unordered_map<std::string,I> kn;
+  std::vector<std::string> names;
+  std::thread timer;
+  std::mutex m;
+  std::condition_variable cv;
+  bool halt;
+  std::vector<I> as, pk, hs;
+  std::vector<uint64_t> na, nb;
+  struct Event {
+    uint64_t t;
+    uint32_t k, a;
+  };
+  std::vector<Event> ev;
+  uint64_t en;
+  std::string ef;
+  std::chrono::steady_clock::time_point t0;
+};
+
+/* pf: profiling (bit 0), sampling (bit 1), tracking allocations (bit 2) and recording events (bit 3), the profile when
+   pf is nonzero, and the allocating primitive ap+1 when tracking or 0 when the closure or macro applied allocates */
+I pf, ap;
+Prof *prof;
+
+/* start profiling (m=1) or sampling (m=2), clears the previous profile unless already profiling or sampling */
+void begin(I m) {
+  if (!pf) {
+    delete prof;
+    prof = new Prof;
+    prof->nodes.push_back({0, 0});              /* the root of the call tree */
+    prof->ns.push_back(0);
+    prof->hits.push_back(0);
+    for (auto q : pr)
+      q->fs.clear();                            /* forget the frames of suspended processes */
+  }
+  pf |= m;
+}
+
+/* return the number of the name of closure or macro f, the name it is bound to in its scope or the global env */
+I key(L f) {
+  Prof& w = *prof;
+  auto k = w.kc.find(ord(f));
+  if (k != w.kc.end())
+    return k->second;
+  return w.kc[ord(f)] = name(named(f));
+}
+
+/* return the number of name s */
+I name(const char *s) {
+  Prof& w = *prof;
+  auto j = w.kn.emplace(s, w.names.size());
+  if (j.second)
+    w.names.push_back(s);
+  return j.first->second;
+}
+
+/* return the call tree node of name k called from node p */
+I node(I p, I k) {
+  Prof& w = *prof;
+  auto j = w.tree.emplace(static_cast<uint64_t>(p) << 32 | k, w.nodes.size());
+  if (j.second) {
+    w.nodes.push_back({p, k});
+    w.ns.push_back(0);
+    w.hits.push_back(0);
+  }
+  return j.first->second;
+}
+
+/* closure or macro f is applied in a step() with stack pointer k that profiled pd frames before, a previous f returns
+   by a tail call, the frames above k left by an error that was not caught return */
+void enter(L f, I& pd, I k) {
+  Prof& w = *prof;
+  if (pd == ~0U) {
+    I n = w.fs.size();
+    while (n && w.fs[n-1].sp <= k)
+      --n;
+    if (n < w.fs.size())
+      leave(n);
+    pd = n;
+  }
+  else
+    leave(pd);
+  if (pf & 1) {
+    auto t = std::chrono::steady_clock::now();
+    I i = key(f), p = node(w.fs.empty() || w.fs.back().node == ~0U ? 0 : w.fs.back().node, i);
+    auto& x = w.st[i];
+    ++x.calls;
+    ++x.active;
+    w.fs.push_back({f, k, i, p, ap, t, 0, conses, 0});
+  }
+  else
+    w.fs.push_back({f, k, pf & 8 ? key(f) : ~0U, ~0U, ap, {}, 0, 0, 0});
+  if (pf & 8)
+    event(1, w.fs.back().key);
+  ap = 0;
+}
+
+/* the profiled frames above n return */
+void leave(I n) {
+  Prof& w = *prof;
+  auto t = pf & 1 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+  while (w.fs.size() > n) {
+    auto f = w.fs.back();
+    w.fs.pop_back();
+    ap = f.ap;
+    if ((pf & 8) && f.key != ~0U)
+      event(2, f.key);
+    if (f.node == ~0U)                          /* not profiled */
+      continue;
+    uint64_t d = std::chrono::duration_cast<std::chrono::nanoseconds>(t - f.t).count(), c = f.c - conses;
+    auto& x = w.st[f.key];
+    x.excl += d - f.child;
+    x.cons += c - f.cchild;
+    if (!--x.active)
+      x.incl += d;
+    w.ns[f.node] += d - f.child;
+    if (!w.fs.empty()) {
+      w.fs.back().child += d;
+      w.fs.back().cchild += c;
+    }
+  }
+}
+
+/* attribute the pair at cell i (n=0) or the n bytes of the atom/string at heap offset i to the closure, macro or
+   primitive that allocates, the atom/string reference field holds the site until the next compact() */
+void site(I i, I n) {
+  Prof& w = *prof;
+  I k;
+  if (ap) {
+    if (w.pk.size() < ap)
+      w.pk.resize(ap, ~0U);
+    if (w.pk[ap-1] == ~0U)
+      w.pk[ap-1] = name(prim[ap-1].s);
+    k = w.pk[ap-1];
+  }
+  else if (w.fs.empty())
+    k = name("toplevel");
+  else {
+    auto& f = w.fs.back();
+    if (f.key == ~0U)
+      f.key = key(f.f);
+    k = f.key;
+  }
+  if (n)
+    *(I*)(A+i-R) = k;
+  else
+    w.as[i/2] = k;
+  if (w.na.size() <= k) {
+    w.na.resize(k+1);
+    w.nb.resize(k+1);
+  }
+  ++w.na[k];
+  w.nb[k] += n ? n : 2*sizeof(L);
+}
+
+/* primitive i is called */
+void call(I i) {
+  if (pf & 8)
+    event(3, i);
+  if ((pf & 4) && !(prim[i].m & SPECIAL))       /* attribute allocations to the primitive */
+    ap = i+1;
+}
+
+/* record event of kind k with argument a in the ring buffer */
+void event(uint32_t k, uint32_t a) {
+  Prof& w = *prof;
+  auto& e = w.ev[w.en++ & (w.ev.size()-1)];
+  e.t = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - w.t0).count();
+  e.k = k;
+  e.a = a;
+}
+
+/* record error n, then write the events to the file given to record() unless the error is caught */
+void fault(int n) {
+  Prof& w = *prof;
+  event(6, n);
+  if (!w.ef.empty() && !cn)                     /* write the events when the error is not caught by catch */
+    if (FILE *f = fopen(w.ef.c_str(), "wb")) {
+      std::string s = events();
+      fwrite(s.data(), 1, s.size(), f);
+      fclose(f);
+    }
+}
+
+/* count a sample of the chain of closures and macros applied, called by poll() at a safe point */
+void hit() {
+  Prof& w = *prof;
+  I p = 0;
+  for (auto& f : w.fs)
+    p = node(p, key(f.f));
+  ++w.hits[p];
+}
+
+/* return the call tree nodes with counts v/d in folded stacks format, one "name;name;name count" line per node */
+std::string fold(const std::vector<uint64_t>& v, uint64_t d) {
+  std::string s, t;
+  Prof& w = *prof;
+  for (I i = 1; i < w.nodes.size(); ++i) {
+    uint64_t n = v[i]/d;
+    if (!n)
+      continue;
+    t.clear();
+    for (I j = i; j; j = w.nodes[j].first)     /* the path from the root to node i, reversed */
+      t.insert(0, (j == i ? "" : ";")).insert(0, w.names[w.nodes[j].second]);
+    s += t;
+    s += ' ';
+    s += std::to_string(n);
+    s += '\n';
+  }
+  return s;
+}
+
+/* write s to the file named by string x */
+void dump(const std::string& s, L x) {
+  FILE *f = fopen(A+ord(x), "w");
+  if (!f)
+    ERR(5, "cannot write %s ", A+ord(x));
+  fwrite(s.data(), 1, s.size(), f);
+  fclose(f);
+}
+
+/*----------------------------------------------------------------------------*\
+ |      PROCESSES AND CHANNELS                                                |
+\*----------------------------------------------------------------------------*/
+
+public:
+
+/* spawn a process to apply thunk f, returns the process number, the process runs when the running process yields or
+   waits on a channel, the processes share the part of the stack below the stack pointer of the first spawn */
+L spawn(L f) {
+  L *p = push(f); I i, k = sp+1;
+  if (pr.empty()) {                             /* the main process 0 runs on the C stack of the caller */
+    I r = ord(cons(nil, nil));
+    pr.push_back(new Proc);
+    pr[0]->rec = r;
+    pb = k;
+  }
+  if (fr.empty()) {                             /* create a process or reuse a process that ended */
+    I r = ord(cons(nil, nil));
+    i = pr.size();
+    pr.push_back(new Proc);
+    pr[i]->stack = stack();
+    pr[i]->rec = r;
+  }
+  else {
+    i = fr.back();
+    fr.pop_back();
+  }
+  Proc& q = *pr[i];
+  if (!q.stack)
+    err(7);
+  q.st = q.own = q.err = 0;
+  cell[q.rec+1] = *p;                           /* the thunk to apply */
+  getcontext(&q.uc);
+  q.uc.uc_stack.ss_sp = q.stack;
+  q.uc.uc_stack.ss_size = Z;
+  q.uc.uc_link = NULL;
+  uint64_t a = reinterpret_cast<uintptr_t>(this);
+  makecontext(&q.uc, reinterpret_cast<void(*)()>(&This::entry), 2, static_cast<I>(a >> 32), static_cast<I>(a));
+  rq.push_back(i);
+  unwind(k);
+  return i;
+}
+
+/* suspend the running process to run the ready processes, returns when it is its turn again */
+void yield() {
+  if (!rq.empty()) {
+    rq.push_back(cur);
+    swap(ready());
+  }
+}
+
+/* queue x on channel c, a pair (items . last item), and make a process waiting on c ready, returns x, c and x must
+   be protected from getting GC'ed by the caller */
+L send(L c, L x) {
+  if (T(c) != CONS)
+    err(5);
+  L y = cons(x, nil), z = CDR(c);
+  if (T(z) == CONS)
+    CDR(z) = y;
+  else
+    CAR(c) = y;
+  CDR(c) = y;
+  auto k = cw.find(ord(c));
+  if (k != cw.end()) {
+    rq.push_back(k->second.front());
+    k->second.pop_front();
+    if (k->second.empty())
+      cw.erase(k);
+  }
+  return CAR(y);
+}
+
+/* return the next item queued on channel c, the running process waits until an item is sent, raises err(9) when no
+   process is ready to send */
+L recv(L c) {
+  L x, y;
+  if (T(c) != CONS)
+    err(5);
+  while (x = CAR(c), T(x) != CONS) {
+    if (rq.empty() && !cur)                     /* the main process cannot wait when no process is ready */
+      err(9);
+    cell[pr[cur]->rec+1] = c;                   /* keep channel c while waiting */
+    cw[ord(c)].push_back(cur);
+    swap(ready());
+    cell[pr[cur]->rec+1] = nil;
+    if (dl) {                                   /* the main process is resumed when all other processes wait */
+      auto k = cw.find(ord(c));
+      k->second.erase(std::find(k->second.begin(), k->second.end(), cur));
+      if (k->second.empty())
+        cw.erase(k);
+      dl = 0;
+      err(9);
+    }
+  }
+  y = CDR(x);
+  CAR(c) = y;
+  if (T(y) != CONS)
+    CDR(c) = nil;
+  return CAR(x);
+}
+
+/* evaluate x in the global environment in a new process launched by the host, returns the process number when the
+   process is done or suspended, raises err(9) when the process waits on a channel and no process is ready to send */
+I launch(L x) {
+  L *p = push(x);
+  I i = spawn(closure(nil, *p, env));
+  unwind(sp+1);
+  pr[i]->own = 1;
+  await(i);
+  return i;
+}
+
+/* suspend the running process with request x for the host, returns the value y passed to resume(i, y) by the host */
+L suspend(L x) {
+  if (!cur)                                     /* the main process cannot be suspended */
+    err(5);
+  Proc& q = *pr[cur];
+  cell[q.rec+1] = x;
+  q.st = 1;
+  swap(ready());
+  x = cell[q.rec+1];
+  cell[q.rec+1] = nil;
+  return x;
+}
+
+/* returns 0 when process i is ready or running, 1 when suspended for the host, 2 when done */
+I status(I i) {
+  return i < pr.size() ? pr[i]->st : 0;
+}
+
+/* returns the request of process i suspended for the host, or nil */
+L request(I i) {
+  return status(i) == 1 ? cell[pr[i]->rec+1] : nil;
+}
+
+/* resume process i suspended for the host with value x, returns when the process is done or suspended again, raises
+   err(9) when the process waits on a channel and no process is ready to send */
+void resume(I i, L x) {
+  if (status(i) != 1)
+    err(5);
+  Proc& q = *pr[i];
+  cell[q.rec+1] = x;
+  q.st = 0;
+  rq.push_back(i);
+  await(i);
+}
+
+/* returns the value of process i launched by the host when done and releases the process, or raises its error */
+L result(I i) {
+  if (status(i) != 2)
+    err(5);
+  Proc& q = *pr[i];
+  L x = cell[q.rec+1];
+  int n = q.err;
+  cell[q.rec+1] = nil;
+  q.st = q.own = 0;
+  fr.push_back(i);
+  return n ? err(n) : x;
+}
+
+protected:
+
+/* run the processes until process i launched by the host is done or suspended, when process i waits on a channel and
+   no process is ready to send, process i ends with err(9), which is raised after releasing the process */
+void await(I i) {
+  Proc& q = *pr[i];
+  I d = 0;
+  while (!q.st) {
+    if (rq.empty()) {                           /* process i waits on a channel, resume it to raise err(9) */
+      d = dl = 1;
+      rq.push_back(i);
+    }
+    yield();
+  }
+  if (d)
+    result(i);
+}
+
+/* a process has its own C stack and a copy of its part of the Lisp stack [sp,pb) saved in the pool when suspended */
+struct Proc {
+  ucontext_t uc;                                /* the C context of the suspended process */
+  char *stack = NULL;                           /* the C stack, the main process 0 uses the C stack of the caller */
+  I rec = 0;                                    /* the pair (saved Lisp stack . thunk or channel waited on) in the pool */
+  I sp = 0;                                     /* the saved stack pointer */
+  I st = 0;                                     /* 0 ready or running, 1 suspended for the host, 2 done */
+  I own = 0;                                    /* nonzero when launched by the host, which takes the result */
+  int err = 0;                                  /* the error code of a process launched by the host */
+  std::vector<typename Prof::Frame> fs;         /* the profiled frames of the suspended process */
+};
+
+/* C stack size of a process */
+static const size_t Z = 256*1024 + 64*S;
+
+/* allocate a C stack of Z bytes for a process with a guard page below it, returns NULL when out of memory */
+static char *stack() {
+  size_t g = sysconf(_SC_PAGESIZE);
+  void *p = mmap(NULL, g+Z, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  mprotect(p, g, PROT_NONE);                    /* a C stack overflow faults instead of overwriting memory */
+  return static_cast<char*>(p)+g;
+}
+
+/* pr:  the processes, process 0 is the main process
+   fr:  the processes that ended, to reuse
+   rq:  the ready processes
+   cw:  the processes waiting on a channel, by channel pair
+   cur: the running process
+   pb:  the stack base of the processes
+   dl:  nonzero when the main process or a process launched by the host is resumed to raise err(9) in recv() */
+std::vector<Proc*> pr;
+std::vector<I> fr;
+std::deque<I> rq;
+std::unordered_map<I,std::deque<I>> cw;
+I cur, pb, dl;
+
+/* the C entry point of a process, makecontext() passes this in two halves */
+static void entry(I hi, I lo) {
+  reinterpret_cast<This*>(static_cast<uintptr_t>(static_cast<uint64_t>(hi) << 32 | lo))->run();
+}
+
+/* return the next ready process, or the main process waiting on a channel when no process is ready */
+I ready() {
+  if (rq.empty()) {
+    dl = 1;
+    return 0;
+  }
+  I i = rq.front();
+  rq.pop_front();
+  return i;
+}
+
+/* suspend the running process to run process j, saving the Lisp stack [sp,pb) of the running process in the pool */
+void swap(I j) {
+  Proc& q = *pr[cur];
+  uint64_t c = conses;
+  q.sp = sp;
+  for (I k = pb; k < sp; ++k)                   /* clear the stack below the main process above the stack base */
+    cell[k] = nil;
+  conses = ~0ULL;                               /* saving the stack does not count towards the cons limit */
+  for (I k = pb; k-- > sp; )
+    cell[q.rec] = cons(cell[k], cell[q.rec]);
+  conses = c;
+  Proc& r = *pr[j];
+  cur = j;
+  if (pf)
+    std::swap(prof->fs, q.fs);                  /* save the profiled frames of the running process */
+  swapcontext(&q.uc, &r.uc);
+  if (pf)
+    std::swap(prof->fs, q.fs);                  /* restore the profiled frames */
+  L x = cell[q.rec];                            /* resumed, restore the saved Lisp stack */
+  for (I k = sp = q.sp; T(x) == CONS; x = CDR(x))
+    cell[k++] = CAR(x);
+  cell[q.rec] = nil;
+}
+
+/* run the thunk of the process on its own stacks, then resume the next process */
+void run() {
+  I i = cur, j;
+  int n = 0;
+  L x = nil;
+  sp = pb;
+  try {
+    x = apply(cell[pr[i]->rec+1], nil);
+  }
+  catch (int k) {
+    n = k;
+  }
+  catch (...) {                                 /* (quit) ends the process */
+  }
+  sp = pb;
+  if (n) {                                      /* recover the pairs of the process, e.g. when out of memory */
+    try {
+      gc();
+    }
+    catch (int) {
+    }
+  }
+  Proc& q = *pr[i];
+  if (q.own) {                                  /* keep the value or error for the host */
+    cell[q.rec+1] = x;
+    q.err = n;
+    q.st = 2;
+  }
+  else {
+    if (n) {
+      flush();
+      fprintf(stderr, "ERR %d: %s in process %u\n", n, error(n), i);
+    }
+    cell[q.rec+1] = nil;
+    fr.push_back(i);
   }
-  putc(')', out);
+  if (pf)
+    prof->fs.clear();
+  cur = j = ready();
+  setcontext(&pr[j]->uc);
 }
 
 };
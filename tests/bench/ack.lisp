@@ -0,0 +1,20 @@
+; ack -- Ackermann function, deep recursion that stresses the stack
+
+(load "../../src/init.lisp")
+
+(define ack
+    (lambda (m n)
+        (cond
+            ((eq? m 0) (+ n 1))
+            ((eq? n 0) (ack (- m 1) 1))
+            (#t (ack (- m 1) (ack m (- n 1)))))))
+
+(define repeat
+    (lambda (k)
+        (if (< 0 k)
+            (begin
+                (ack 2 9)
+                (repeat (- k 1))))))
+
+(repeat 200)
+(quit)
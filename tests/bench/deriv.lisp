@@ -0,0 +1,30 @@
+; deriv -- symbolic differentiation, allocates many short-lived lists
+
+(load "../../src/init.lisp")
+
+(define deriv
+    (lambda (a)
+        (cond
+            ((not (pair? a))
+                (if (eq? a 'x) 1 0))
+            ((eq? (car a) '+)
+                (cons '+ (mapcar deriv (cdr a))))
+            ((eq? (car a) '-)
+                (cons '- (mapcar deriv (cdr a))))
+            ((eq? (car a) '*)
+                (list '* a (cons '+ (mapcar (lambda (a) (list '/ (deriv a) a)) (cdr a)))))
+            ((eq? (car a) '/)
+                (list '-
+                    (list '/ (deriv (car (cdr a))) (car (cdr (cdr a))))
+                    (list '/ (car (cdr a)) (list '* (car (cdr (cdr a))) (car (cdr (cdr a))) (deriv (car (cdr (cdr a))))))))
+            (#t (throw 1)))))
+
+(define repeat
+    (lambda (k)
+        (if (< 0 k)
+            (begin
+                (deriv '(+ (* 3 x x) (* a x x) (* b x) 5))
+                (repeat (- k 1))))))
+
+(repeat 10000)
+(quit)
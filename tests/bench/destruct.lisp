@@ -0,0 +1,43 @@
+; destruct -- destructive list operations with set-car! and set-cdr!
+
+(load "../../src/init.lisp")
+
+; destructively reverse list t
+(define nreverse
+    (lambda (t)
+        (let*
+            (r ())
+            (n ())
+            (begin
+                (while t
+                    (setq n (cdr t))
+                    (set-cdr! t r)
+                    (setq r t)
+                    (setq t n))
+                r))))
+
+; destructively replace the elements of list t by k, k+1, k+2, ...
+(define fill!
+    (lambda (t k)
+        (while t
+            (set-car! t k)
+            (setq k (+ k 1))
+            (setq t (cdr t)))))
+
+; the list (0 1 2 ... 499) built with a loop, because seq is not tail recursive
+(define l ())
+(define k 500)
+(while (< 0 k)
+    (setq k (- k 1))
+    (setq l (cons k l)))
+
+(define repeat
+    (lambda (k)
+        (if (< 0 k)
+            (begin
+                (setq l (nreverse l))
+                (fill! l k)
+                (repeat (- k 1))))))
+
+(repeat 1000)
+(quit)
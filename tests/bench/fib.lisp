@@ -0,0 +1,12 @@
+; fib -- doubly recursive Fibonacci, function call overhead
+
+(load "../../src/init.lisp")
+
+(define fib
+    (lambda (n)
+        (if (< n 2)
+            n
+            (+ (fib (- n 1)) (fib (- n 2))))))
+
+(fib 22)
+(quit)
@@ -0,0 +1,5 @@
+; nqueens -- the n-queens solver of examples/nqueens.lisp for an 8x8 board
+
+(load "../../src/init.lisp")
+(load "../../examples/nqueens.lisp")
+(quit)
@@ -0,0 +1,27 @@
+// print.cpp printer benchmark of lisp.hpp printing 10^6 numbers
+// c++ -std=c++17 -o printbench -O2 print.cpp && ./printbench
+
+#include "../../src/lisp.hpp"
+#include <chrono>
+
+typedef Lisp<4000000,100000> BigLisp;
+
+// return the time in seconds to evaluate s
+static double bench(BigLisp& lisp, const char *s) {
+  auto t0 = std::chrono::steady_clock::now();
+  lisp.eval_string(s);
+  lisp.flush();
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+  return dt.count();
+}
+
+int main(int argc, char **argv) {
+  BigLisp *lisp = new BigLisp;
+  lisp->out = fopen(argc > 1 ? argv[1] : "/dev/null", "w");
+  lisp->eval_string("(define loop (lambda (i n) (if (< i n) (begin (print (/ i 7)) (loop (+ i 1) n)))))");
+  printf("print 10^6 numbers one by one: %.3fs\n", bench(*lisp, "(loop 0 1000000)"));
+  lisp->eval_string("(define big ()) (define n 0) (while (< n 1000000) (setq big (cons (/ n 7) big)) (setq n (+ n 1)))");
+  printf("print a list of 10^6 numbers: %.3fs\n", bench(*lisp, "(print big)"));
+  fclose(lisp->out);
+  delete lisp;
+}
@@ -0,0 +1,24 @@
+; qsort -- the quicksort functions of examples/qsort.lisp on pseudo-random numbers
+
+(load "../../src/init.lisp")
+(load "../../examples/qsort.lisp")
+
+; list of n pseudo-random numbers from a linear congruential generator with seed x
+(define random-list
+    (lambda (n x)
+        (if (< 0 n)
+            (cons x (random-list (- n 1) (mod (+ (* x 1103515245) 12345) 2147483648)))
+            ())))
+
+(define data (random-list 200 42))
+
+(define repeat
+    (lambda (k)
+        (if (< 0 k)
+            (begin
+                (qsort data)
+                (quick data)
+                (repeat (- k 1))))))
+
+(repeat 50)
+(quit)
@@ -0,0 +1,65 @@
+// read.cpp reader microbenchmark of the lisp.hpp parser
+// c++ -std=c++17 -o readbench -O2 read.cpp && ./readbench ../../src/init.lisp
+
+#include "../../src/lisp.hpp"
+#include <chrono>
+#include <string>
+
+typedef Lisp<4000000,1000000> BigLisp;
+
+// return the contents of file name
+static std::string slurp(const char *name) {
+  std::string s;
+  char buf[4096];
+  size_t n;
+  FILE *f = fopen(name, "r");
+  if (!f) {
+    perror(name);
+    exit(EXIT_FAILURE);
+  }
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    s.append(buf, n);
+  fclose(f);
+  return s;
+}
+
+// return a large generated data file with numbers, symbols and strings
+static std::string generate(int n) {
+  std::string s = "(";
+  char buf[128];
+  for (int i = 0; i < n; ++i) {
+    snprintf(buf, sizeof(buf), "(item-%d %d %.6f -%de3 \"name %d\" (x y z) .5 inf)\n", i%100, i, i/7.0, i, i);
+    s += buf;
+  }
+  return s + ")";
+}
+
+// time reading s as a single list k times, return MB/s
+static double bench(BigLisp& lisp, const std::string& s, int k) {
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < k; ++i)
+    lisp.read_string(s);
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+  return s.size()*k/dt.count()/1e6;
+}
+
+// time deserializing the serialized form of s k times, return MB/s relative to the size of s
+static double unbench(BigLisp& lisp, const std::string& s, int k) {
+  std::string b = lisp.serialize(lisp.read_string(s));
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < k; ++i)
+    lisp.deserialize(b);
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+  return s.size()*k/dt.count()/1e6;
+}
+
+int main(int argc, char **argv) {
+  BigLisp *lisp = new BigLisp;
+  std::string code = "(" + slurp(argc > 1 ? argv[1] : "../../src/init.lisp") + "\n)";
+  std::string data = generate(argc > 2 ? atoi(argv[2]) : 100000);
+  printf("init.lisp %zu bytes: %.1f MB/s\n", code.size(), bench(*lisp, code, 2000));
+  printf("init.lisp deserialized: %.1f MB/s\n", unbench(*lisp, code, 2000));
+  printf("data %zu bytes: %.1f MB/s\n", data.size(), bench(*lisp, data, 5));
+  printf("data deserialized: %.1f MB/s\n", unbench(*lisp, data, 5));
+  delete lisp;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# run.sh benchmark harness: builds the interpreters with -O2 -DSTATS, runs each workload N times and prints CSV
+# usage: ./run.sh [N [workload ...]] > results.csv
+# prints: interpreter,workload,runs,median_s,gc,peak_stack,status
+# where median_s is the median wall clock time in seconds, gc is the number of garbage collections and peak_stack is
+# the peak stack depth in cells as reported by (quit), and status is ok or fail when a workload did not reach (quit)
+# requires GNU date for nanosecond timing and timeout to stop runs that fail, change CC, CXX and TIMEOUT as needed
+
+N=${1:-5}
+[ $# -gt 0 ] && shift
+WORKLOADS=${*:-"tak fib ack deriv destruct strings nqueens qsort"}
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+TIMEOUT=${TIMEOUT:-60}
+BIN=${TMPDIR:-/tmp}/lispbench.$$
+mkdir -p "$BIN" || exit 1
+trap 'rm -rf "$BIN"' EXIT INT TERM
+
+$CC -O2 -DSTATS -o "$BIN/lisp" ../../src/lisp.c || exit 1
+$CC -O2 -DSTATS -o "$BIN/lisp-pr" ../../src/lisp-pr.c || exit 1
+$CC -O2 -DSTATS -o "$BIN/lisp-pr-single" ../../src/lisp-pr-single.c || exit 1
+$CXX -std=c++17 -O2 -pthread -DSTATS -o "$BIN/lisp-repl" ../../src/lisp-repl.cpp || exit 1
+
+echo "interpreter,workload,runs,median_s,gc,peak_stack,status"
+for w in $WORKLOADS; do
+  for b in lisp lisp-pr lisp-pr-single lisp-repl; do
+    : > "$BIN/times"
+    status=ok
+    i=0
+    while [ $i -lt "$N" ]; do
+      t0=$(date +%s%N)
+      timeout "$TIMEOUT" "$BIN/$b" "$w.lisp" < /dev/null > /dev/null 2> "$BIN/stats"
+      t1=$(date +%s%N)
+      grep -q '^gc ' "$BIN/stats" || status=fail
+      echo "$t0 $t1" | awk '{ printf "%.6f\n", ($2 - $1) / 1e9 }' >> "$BIN/times"
+      i=$((i + 1))
+    done
+    median=$(sort -n "$BIN/times" | awk '{ t[NR] = $1 } END { printf "%.6f", NR % 2 ? t[(NR + 1) / 2] : (t[NR / 2] + t[NR / 2 + 1]) / 2 }')
+    stats=$(awk '/^gc / { print $2 "," $4 }' "$BIN/stats")
+    echo "$b,$w,$N,$median,${stats:-,},$status"
+  done
+done
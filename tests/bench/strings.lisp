@@ -0,0 +1,23 @@
+; strings -- string building with string concatenation and number formatting
+
+(load "../../src/init.lisp")
+
+(define build
+    (lambda (n)
+        (let*
+            (s "")
+            (begin
+                (while (< 0 n)
+                    (setq s (string s n " "))
+                    (setq n (- n 1)))
+                s))))
+
+(define repeat
+    (lambda (k)
+        (if (< 0 k)
+            (begin
+                (build 50)
+                (repeat (- k 1))))))
+
+(repeat 2000)
+(quit)
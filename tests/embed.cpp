@@ -0,0 +1,250 @@
+// embed.cpp tests the lisp.hpp C++ embedding API
+// c++ -std=c++17 -o testembed -DDEBUG -O2 -pthread embed.cpp
+
+#include "../src/lisp.hpp"
+#include <string>
+
+typedef Lisp<8192,2048> MyLisp;
+
+static MyLisp *lisp;
+
+// instrumentation hooks that count events
+struct Counts : LispHooks {
+  int gcs = 0, gce = 0, calls = 0, returns = 0, prims = 0, err = 0;
+  std::string last;
+  void gc_begin(uint32_t, uint32_t) { ++gcs; }
+  void gc_end(uint32_t, uint32_t) { ++gce; }
+  template<class Lisp> void enter(Lisp& lisp, double f) { ++calls; last = lisp.named(f); }
+  template<class Lisp> void leave(Lisp&, double) { ++returns; }
+  void prim(const char*) { ++prims; }
+  void error(int n) { err = n; }
+};
+
+// the number of futures the pool of the interpreter keeps
+struct Peek : MyLisp {
+  static size_t futures(MyLisp *l) {
+    auto w = l->*&Peek::pool;
+    return w ? w->fs.size() : 0;
+  }
+};
+
+// error routine
+static void report(const char *what) {
+  printf("FAILED %s\n", what);
+  exit(EXIT_FAILURE);
+}
+
+// true if the printed form of x equals s
+static bool prints(MyLisp::L x, const char *s) {
+  char buf[256] = "";
+  FILE *f = fmemopen(buf, sizeof(buf), "w");
+  lisp->out = f;
+  lisp->print(x);
+  lisp->flush();
+  fclose(f);
+  lisp->out = stdout;
+  return !strcmp(buf, s);
+}
+
+// evaluate s and return the error code or 0
+static int fails(const char *s) {
+  try {
+    lisp->eval_string(s);
+  }
+  catch (int n) {
+    return n;
+  }
+  return 0;
+}
+
+int main() {
+  lisp = new MyLisp;
+  if (!prints(lisp->read_string("(a b . c)"), "(a b . c)")) report("read_string");
+  if (!prints(lisp->read_string("  ; comment\n'x"), "(quote x)")) report("read_string");
+  if (!prints(lisp->read_string("(1 -2 .5 -.5 +5 1e3 inf -inf 0x10 1e999)"), "(1 -2 0.5 -0.5 5 1000 inf -inf 16 inf)")) report("read numbers");
+  if (!prints(lisp->read_string("(0.1 1e+300 -1.5e-7 123456789012 0.30000000000000004)"), "(0.1 1e+300 -1.5e-07 123456789012 0.30000000000000004)")) report("print numbers");
+  if (!prints(lisp->eval_string("(string 0.1 'x -2)"), "\"0.1x-2\"")) report("string numbers");
+  if (!prints(lisp->read_string("(- + ... -x 1a 1e inf? x1 +-5)"), "(- + ... -x 1a 1e inf? x1 +-5)")) report("read symbols");
+  if (lisp->read_string("nan") == lisp->read_string("nan")) report("read nan");
+  std::string t = "(eq? \"" + std::string(2000, 'x') + "\" (string '" + std::string(2000, 'x') + "))";
+  if (!prints(lisp->eval_string(t), "#t")) report("read long tokens");
+  if (!prints(lisp->eval_string(""), "()")) report("eval_string");
+  if (!prints(lisp->eval_string("(+ 1 2 3)"), "6")) report("eval_string");
+  if (!prints(lisp->eval_string("(define x 3) ; comment\n(cons x 'y) ; last"), "(3 . y)")) report("eval_string");
+  std::string_view s("(+ x 1)(+ x 2)", 7);
+  if (!prints(lisp->eval_string(s), "4")) report("eval_string");
+  if (!prints(lisp->eval_string("(begin (read) 'skip) (+ 1 2)"), "skip")) report("eval_string read");
+  if (fails("(+ 1 2") != 8) report("eval_string syntax");
+  if (fails("undefined-symbol") != 3) report("eval_string unbound");
+  if (!prints(lisp->eval_string("(catch (car 1))"), "(ERR . 1)")) report("eval_string catch");
+  if (!prints(lisp->eval_string("(load \"../src/init.lisp\") (list 1 2)"), "(1 2)")) report("eval_string load");
+  if (!prints(lisp->eval_string("(define s \"Hello, World\") (list (string-length s) (string-ref s 1) (substring s 7) (string-index s \"o\" 5) (string-search s \"World\") (string-search s \"x\") (string-upcase (substring s 0 5)))"), "(12 101 \"World\" 8 7 () \"HELLO\")")) report("strings");
+  if (!prints(lisp->eval_string("(list (string-split \"a,b,,c\" 44) (string-split \"a::b\" \"::\") (string->number \"-1.5e3\") (string->number \"x1\") (number->string 0.1) (catch (string-ref s 12)))"), "((\"a\" \"b\" \"\" \"c\") (\"a\" \"b\") -1500 () \"0.1\" (ERR . 5))")) report("string-split");
+  if (!prints(lisp->eval_string("(deserialize (serialize '(1 -2 2.5 -0.0 1e300 inf \"str\" sym (a . b) () car)))"), "(1 -2 2.5 -0 1e+300 inf \"str\" sym (a . b) () car)")) report("serialize");
+  if (!prints(lisp->eval_string("(eq? car (car (deserialize (serialize (list car)))))"), "#t")) report("serialize primitive");
+  if (!prints(lisp->eval_string("(define p '(1 2)) (define q (deserialize (serialize (cons p p)))) (eq? (car q) (cdr q))"), "#t")) report("serialize shared");
+  if (!prints(lisp->eval_string("(define c (list 1 2)) (set-cdr! (cdr c) c) (define d (deserialize (serialize c))) (eq? (cdr (cdr d)) d)"), "#t")) report("serialize cycle");
+  if (!prints(lisp->eval_string("(define add (lambda (n) (lambda (x) (+ x n)))) ((deserialize (serialize (add 3))) 4)"), "7")) report("serialize closure");
+  if (!prints(lisp->eval_string("(eq? (deserialize (serialize (env))) (env))"), "#t")) report("serialize env");
+  if (!prints(lisp->eval_string("(pmap (lambda (x) (string x x)) '(a \"b\" 1 2 3))"), "(\"aa\" \"bb\" \"11\" \"22\" \"33\")")) report("pmap");
+  if (!prints(lisp->eval_string("(preduce + 0.5 '(1 2 3 4 5))"), "15.5")) report("preduce");
+  if (!prints(lisp->eval_string("(define a (future (cons 'x \"y\"))) (define b (future (cons (touch a) (touch a)))) (list (touch b) (touch 1) a)"), "(((x . \"y\") x . \"y\") 1 <future>)")) report("future");
+  if (fails("(touch (future (car 1)))") != 1) report("future error");
+  if (lisp->eval_string("(define g1 (lambda (x) (* x k))) (define k 1) (define k 2) (define g2 (lambda (x) (+ (g1 x) 1))) (touch (future (g2 20)))") != 41) report("future globals");
+  if (!prints(lisp->eval_string("(pmap g2 '(1 2 3))"), "(3 5 7)")) report("pmap globals");
+  lisp->eval_string("(setq a ()) (setq b ()) (touch (future (future 1)))");
+  lisp->gc();
+  if (Peek::futures(lisp)) report("future release");
+  if (fails("(pmap car '(1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16))") != 1 || !prints(lisp->eval_string("(pmap (lambda (x) (* x x)) '(1 2 3))"), "(1 4 9)")) report("pmap after error");
+  if (!prints(lisp->eval_string("(define k 0) (define p (delay (begin (setq k (+ k 1)) (string k)))) (list (force p) (force p) k p (force 1))"), "(\"1\" \"1\" 1 <promise> 1)")) report("delay");
+  if (!prints(lisp->eval_string("(define p (delay p)) (force p) (define q (deserialize (serialize (list p (future 1))))) (list (eq? (force p) p) (eq? (force (car q)) (car q)) (type p) (type (car (cdr q))) (touch p) (force (car (cdr q))))"), "(#t #t 8 5 <promise> <future>)")) report("delay cycle");
+  if (!prints(lisp->eval_string("(stream-take 3 (stream-filter (lambda (x) (< 5 x)) (stream-map (lambda (x) (* x x)) (stream-range 0 1e9))))"), "(9 16 25)")) report("streams");
+  if (!prints(lisp->eval_string("(define s (stream-cons 'a (car ()))) (list (stream-car s) (catch (stream-cdr s)) (stream-cdr (stream-range 2 3)))"), "(a (ERR . 1) ())")) report("stream-cons");
+  if (!prints(lisp->eval_string("(define c (chan)) (spawn (lambda () (send c (cons 'a (recv c))))) (send c \"b\") (yield) (list (recv c) (catch (recv c)))"), "((a . \"b\") (ERR . 9))")) report("processes");
+  if (!prints(lisp->eval_string("(define p (lambda (k) (lambda () (begin (yield) (send c (string 'p k)))))) (define k 0) (while (< k 20) (begin (spawn (p k)) (setq k (+ k 1)))) (list (recv c) (recv c))"), "(\"p0\" \"p1\")")) report("processes channel");
+  if (!prints(lisp->eval_string("(define deep (lambda (n) (if (< 0 n) (cons n (deep (- n 1))) ()))) (spawn (lambda () (deep 5000))) (yield) (car (deep 10))"), "10")) report("process out of memory");
+  MyLisp::I h = lisp->launch(lisp->read_string("(+ 1 (suspend 'get) (suspend (string 'put)))"));
+  if (lisp->status(h) != 1 || !prints(lisp->request(h), "get")) report("launch");
+  lisp->resume(h, 10);
+  if (lisp->status(h) != 1 || !prints(lisp->request(h), "\"put\"")) report("suspend");
+  lisp->resume(h, 20);
+  if (lisp->status(h) != 2 || lisp->result(h) != 31) report("resume");
+  std::vector<MyLisp::I> hs;
+  for (int i = 0; i < 50; ++i)
+    hs.push_back(lisp->launch(lisp->read_string("(cons (suspend 'x) (suspend 'y))")));
+  for (int i = 50; i-- > 0; )
+    lisp->resume(hs[i], i);
+  for (int i = 0; i < 50; ++i)
+    lisp->resume(hs[i], -i);
+  for (int i = 0; i < 50; ++i)
+    if (!prints(lisp->result(hs[i]), ("(" + std::to_string(i) + " . " + std::to_string(-i) + ")").c_str())) report("resume many");
+  h = lisp->launch(lisp->read_string("(car (suspend ()))"));
+  lisp->resume(h, 1);
+  try { lisp->result(h); report("resume error"); } catch (int n) { if (n != 1) report("resume error"); }
+  try { lisp->launch(lisp->read_string("(recv (chan))")); report("launch wait"); } catch (int n) { if (n != 9) report("launch wait"); }
+  h = lisp->launch(lisp->read_string("(begin (suspend ()) (recv (chan)))"));
+  try { lisp->resume(h, 1); report("resume wait"); } catch (int n) { if (n != 9 || lisp->status(h)) report("resume wait"); }
+  lisp->eval_string("(define d (chan))");
+  h = lisp->launch(lisp->read_string("(begin (spawn (lambda () (send d 1))) (recv d))"));
+  if (lisp->status(h) != 2 || lisp->result(h) != 1) report("launch recv");
+  if (!prints(lisp->eval_string("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))) (profile (fib 10) \"/dev/null\")"), "55")) report("profile");
+  std::string r = lisp->report("calls");
+  if (r.find("       177 ") == std::string::npos || r.find("fib\n") == std::string::npos || lisp->folded().find("\nfib;fib;fib;fib;fib ") == std::string::npos) report("profile report");
+  lisp->profile(1);
+  lisp->eval_string("(catch (mapcar (lambda (x) (fib (car x))) '((1) (2) 3)))");
+  lisp->profile(0);
+  r = lisp->report();
+  if (r.find("lambda\n") == std::string::npos || r.find("mapcar\n") == std::string::npos) report("profile catch");
+  lisp->eval_string("(define C (lambda (x) (begin (fib 12) x))) (define B (lambda (x) (+ (fib x) 0))) (define A (lambda () (B (C 12)))) (define D (lambda () (begin (A) 1))) (profile (D) \"/dev/null\")");
+  r = lisp->folded();
+  if (r.find("\nD;A;C;fib ") == std::string::npos || r.find("\nD;B;fib ") == std::string::npos || r.find("D;B;C") != std::string::npos) report("profile arguments");
+  lisp->sample(2000);
+  lisp->eval_string("(define loop (lambda (k) (if (< 0 k) (begin (fib 10) (loop (- k 1))))))");
+  t = lisp->samples();
+  for (int i = 0; i < 200 && t.find("loop;fib;fib") == std::string::npos; ++i, t = lisp->samples())
+    lisp->eval_string("(loop 5)");
+  lisp->sample(0);
+  if (t.find("loop;fib;fib") == std::string::npos || t.find("\nfib") != std::string::npos) report("sample");
+  lisp->track(1);
+  lisp->eval_string("(define mk (lambda (n) (if (< 0 n) (cons (string n) (mk (- n 1))))))  (define big (mk 100))");
+  r = lisp->census();
+  lisp->track(0);
+  if (r.find("       100        1600         100             1600  cons\n") == std::string::npos || r.find("       100         692         100              692  string\n") == std::string::npos) report("census");
+  if (lisp->census().find("site") != std::string::npos) report("census untracked");
+  lisp->record(4, "embed.trace");
+  lisp->eval_string("(catch (mk 2)) (catch (car 1))");
+  if (FILE *g = fopen("embed.trace", "rb")) { fclose(g); report("record caught"); }
+  if (fails("(car 1)") != 1) report("record error");
+  lisp->record(0);
+  r = lisp->events();
+  std::string d(r.size()+1, '\0');
+  FILE *g = fopen("embed.trace", "rb");
+  d.resize(g ? fread(&d[0], 1, d.size(), g) : 0);
+  if (g) fclose(g);
+  remove("embed.trace");
+  auto event = [&d](int i) { uint32_t k[2]; memcpy(k, &d[d.size()-16*(4-i)+8], sizeof(k)); return 100*k[0] + k[1]; };
+  if (d.size() < 100 || d.compare(0, 8, "LISPTRC1") || r.compare(0, d.size()-80, d, 0, d.size()-80) || event(2)/100 != 3 || event(3) != 601) report("record");
+  if (fails("(trace-record 1e9)") != 5) report("record limit");
+  lisp->fuel = 1000;
+  if (fails("(while #t ())") != 10 || fails("((lambda () 1))") != 10) report("fuel");
+  lisp->fuel = 1000;
+  if (!prints(lisp->eval_string("((lambda () 1))"), "1")) report("fuel refill");
+  lisp->fuel = ~0ULL;
+  lisp->fuel = 1000;
+  if (fails("(pmap (lambda (x) (while #t ())) '(1 2 3 4))") != 10 || fails("(touch (future (while #t ())))") != 10) report("fuel workers");
+  lisp->fuel = 100000;
+  if (!prints(lisp->eval_string("(touch (future ((lambda () 1))))"), "1") || lisp->fuel == 100000) report("fuel charged");
+  lisp->fuel = ~0ULL;
+  lisp->conses = 1000;
+  if (fails("(define l ()) (while #t (setq l (cons 1 l)))") != 11 || fails("(cons 1 2)") != 11) report("cons limit");
+  lisp->conses = ~0ULL;
+  lisp->bytes = 1000;
+  if (fails("(while #t (string 'abcdefgh))") != 12) report("heap limit");
+  lisp->bytes = ~0ULL;
+  auto t0 = std::chrono::steady_clock::now();
+  try { lisp->eval(*lisp->push(lisp->read_string("(while #t ())")), lisp->env, t0 + std::chrono::milliseconds(5)); report("deadline"); } catch (int n) { if (n != 13) report("deadline"); }
+  lisp->pop();
+  if (std::chrono::steady_clock::now() - t0 > std::chrono::milliseconds(500)) report("deadline time");
+  if (!prints(lisp->eval(*lisp->push(lisp->read_string("(catch (while #t ()))")), lisp->env, std::chrono::steady_clock::now()), "(ERR . 13)")) report("deadline catch");
+  lisp->pop();
+  t0 = std::chrono::steady_clock::now();
+  try { lisp->eval(*lisp->push(lisp->read_string("(touch (future (while #t ())))")), lisp->env, t0 + std::chrono::milliseconds(50)); report("deadline future"); } catch (int n) { if (n != 13) report("deadline future"); }
+  lisp->pop();
+  try { lisp->eval(*lisp->push(lisp->read_string("(pmap (lambda (x) (while #t ())) '(1 2 3 4))")), lisp->env, t0 + std::chrono::milliseconds(100)); report("deadline pmap"); } catch (int n) { if (n != 13) report("deadline pmap"); }
+  lisp->pop();
+  if (std::chrono::steady_clock::now() - t0 > std::chrono::milliseconds(1000) || !prints(lisp->eval_string("(pmap (lambda (x) (* x x)) '(1 2 3))"), "(1 4 9)")) report("deadline workers");
+  FILE *f = fopen("embed.tmp", "w");
+  fprintf(f, "; cached\n(define y 1) (cons y '(\"a\" b))\n");
+  fclose(f);
+  remove("embed.tmp.fasl");
+  if (!prints(lisp->eval_string("(load \"embed.tmp\")"), "(1 \"a\" b)")) report("load");
+  if (!(f = fopen("embed.tmp.fasl", "r")) || fclose(f) || !prints(lisp->eval_string("(load 'embed.tmp)"), "(1 \"a\" b)")) report("load cached");
+  f = fopen("embed.tmp", "w");
+  fprintf(f, "(define y 2) y");
+  fclose(f);
+  if (!prints(lisp->eval_string("(load \"embed.tmp\")"), "2")) report("load stale cache");
+  f = fopen("embed.tmp", "w");
+  fprintf(f, "(define y 4) y");
+  fclose(f);
+  if (!prints(lisp->eval_string("(load \"embed.tmp\")"), "4")) report("load same size");
+  std::string c(4096, '\0');
+  f = fopen("embed.tmp.fasl", "r");
+  c.resize(fread(&c[0], 1, c.size(), f));
+  fclose(f);
+  f = fopen("embed.tmp.fasl", "w");
+  fwrite(c.data(), 1, c.size()-2, f);
+  fclose(f);
+  if (!prints(lisp->eval_string("(load \"embed.tmp\")"), "4")) report("load bad cache");
+  f = fopen("embed.tmp", "w");
+  fprintf(f, "(define y 3) (+ y");
+  fclose(f);
+  if (fails("(load \"embed.tmp\")") != 8 || fails("(load \"embed.none\")") != 5) report("load error");
+  remove("embed.tmp");
+  remove("embed.tmp.fasl");
+  MyLisp::L x = lisp->read_string("(serialized data \"with\" 0 1 ())");
+  std::string b = lisp->serialize(x);
+  if (b.find('\0') != std::string::npos || !prints(lisp->deserialize(b), "(serialized data \"with\" 0 1 ())")) report("deserialize");
+  if (fails("(deserialize \"L\")") != 8 || fails("(deserialize \"x\")") != 8) report("deserialize error");
+  delete lisp;
+  Lisp<8192,2048,Counts> *hooked = new Lisp<8192,2048,Counts>;
+  hooked->eval_string("(define f (lambda (x) (g x))) (define g (lambda (x) (+ x 1))) (f (f 1)) (catch (car 1))");
+  hooked->gc();
+  if (hooked->hooks.calls != 4 || hooked->hooks.last != "g" || hooked->hooks.returns != 4 || hooked->hooks.prims < 6 || hooked->hooks.err != 1 || hooked->hooks.gcs < 1 || hooked->hooks.gcs != hooked->hooks.gce) report("hooks");
+  delete hooked;
+  Lisp<16384,1024,LispHooks,4096> *deep = new Lisp<16384,1024,LispHooks,4096>;
+  deep->eval_string("(define len (lambda (t) (if t (+ 1 (len (cdr t))) 0)))"
+                    "(define dup (lambda (s n) (if (eq? n 0) s (dup (string s s) (- n 1)))))"
+                    "(define iota (lambda (n t) (if (eq? n 0) t (iota (- n 1) (cons n t)))))"
+                    "(define down (lambda (n) (+ 1 (down n))))");
+  if (deep->eval_string("(len (iota 500 ()))") != 500 || deep->eval_string("(cdr (catch (down 1)))") != 6) report("deep recursion");
+  if (deep->eval_string("(cdr (catch (dup \"ab\" 20)))") != 7 || deep->eval_string("(len (iota 500 ()))") != 500) report("heap full");
+  delete deep;
+  Lisp<16384,1024> *nest = new Lisp<16384,1024>;
+  nest->eval_string("(define y 0) (define r ())"
+                    "(define h (lambda (n) (if (< 0 n) (+ 1 (begin (setq y (catch (force (delay (h (- n 1)))))) y)) 0)))"
+                    "(define w (lambda (n) (begin (while (< 0 n) (setq n (w (- n 1)))) 0)))");
+  if (nest->eval_string("(spawn (lambda () (setq r (cons (h 500) (catch (w 100000)))))) (yield) (car r)") != 500) report("nested forms");
+  if (nest->eval_string("(cdr (cdr r))") != 6) report("C stack full");
+  delete nest;
+  printf("SUCCESS\n");
+}
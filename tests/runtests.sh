@@ -2,3 +2,9 @@
 cc -o testlisp -DDEBUG -O2 ../src/lisp.c 
 ./testlisp runtests.lisp
 rm -f testlisp
+c++ -std=c++17 -o testembed -DDEBUG -O2 -pthread embed.cpp
+./testembed
+rm -f testembed
+c++ -std=c++17 -o teststress -O2 -pthread stress.cpp
+./teststress
+rm -f teststress
@@ -0,0 +1,108 @@
+// stress.cpp runs lisp.hpp interpreter instances concurrently, one per thread
+// c++ -std=c++17 -o teststress -O2 -pthread stress.cpp
+// Usage: teststress [max-threads]
+// reports the throughput for 1, 2, 4 ... max-threads (the number of cores by default)
+
+#include "../src/lisp.hpp"
+#include <chrono>
+#include <thread>
+
+typedef Lisp<8192,2048> MyLisp;
+
+// the workload evaluated by each instance, recursion and allocation to exercise the evaluator and the GC
+static const char *work =
+  "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+  "(define iota (lambda (n t) (if (eq? n 0) t (iota (- n 1) (cons n t)))))"
+  "(define sum (lambda (t n) (if (eq? t ()) n (sum (cdr t) (+ n (car t))))))"
+  "(define run (lambda (k n) (if (eq? k 0) n (run (- k 1) (+ n (fib 15) (sum (iota 1000 ()) 0))))))";
+
+// error routine
+static void report(const char *what) {
+  printf("FAILED %s\n", what);
+  exit(EXIT_FAILURE);
+}
+
+// evaluate the workload k times in a new instance, returns nonzero if the result is wrong
+static int worker(int k) {
+  MyLisp *lisp = new MyLisp;
+  lisp->batch = 1;
+  lisp->eval_string(work);
+  std::string s = "(run " + std::to_string(k) + " 0)";
+  int bad = lisp->eval_string(s) != (610 + 500500) * static_cast<double>(k);
+  delete lisp;
+  return bad;
+}
+
+// run n instances concurrently, returns the wall clock time in seconds
+static double stress(int n, int k) {
+  std::vector<std::thread> threads;
+  std::vector<int> bad(n);
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; ++i)
+    threads.emplace_back([&bad, i, k] { bad[i] = worker(k); });
+  for (auto& t : threads)
+    t.join();
+  for (int i = 0; i < n; ++i)
+    if (bad[i])
+      report("result");
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char **argv) {
+  int m = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+  if (m < 1)
+    m = 1;
+  // interrupt an endless loop in one instance while another instance keeps running
+  MyLisp *a = new MyLisp, *b = new MyLisp;
+  int ea = 0, eb = 0;
+  std::thread ta([&] { try { a->eval_string("(while #t ())"); } catch (int n) { ea = n; } });
+  std::thread tb([&] { try { b->eval_string(work); b->eval_string("(fib 20)"); } catch (int n) { eb = n; } });
+  tb.join();
+  a->interrupt();
+  ta.join();
+  if (ea != 2 || eb)
+    report("interrupt");
+  if (a->eval_string("(catch (+ 1 2))") != 3)
+    report("interrupt reset");
+  delete a;
+  delete b;
+  // pmap and preduce with m workers return the same as evaluating sequentially without workers
+  for (unsigned w : {0, m}) {
+    a = new MyLisp;
+    a->workers = w;
+    a->eval_string(work);
+    auto t0 = std::chrono::steady_clock::now();
+    MyLisp::L x = a->eval_string("(preduce + 0 (pmap fib '(20 20 20 20 20 20 20 20 19 19 19 19 19 19 19 19)))");
+    MyLisp::L y = a->eval_string("(pmap (lambda (x) (+ (fib 10) (car x))) '((1) (2) (3) (4)))");
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (x != 8*6765 + 8*4181 || a->serialize(y) != a->serialize(a->read_string("(56 57 58 59)")))
+      report("pmap");
+    if (a->serialize(a->eval_string("(catch (pmap car '(1 2 3 4 5 6 7 8)))")) != a->serialize(a->read_string("(ERR . 1)")))
+      report("pmap error");
+    printf("pmap with %u workers %.3f seconds\n", w, t);
+    delete a;
+  }
+  // context switches per second between two processes in one instance, less the time of their loops without yielding
+  a = new MyLisp;
+  a->eval_string("(define loop (lambda (n) (while (< 0 n) (begin (yield) (setq n (- n 1))))))");
+  auto t0 = std::chrono::steady_clock::now();
+  a->eval_string("(loop 200000)");
+  double tl = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  a->eval_string("(define c (chan)) (spawn (lambda () (begin (loop 200000) (send c 'done))))");
+  t0 = std::chrono::steady_clock::now();
+  a->eval_string("(loop 200000)");
+  double ts = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  if (a->serialize(a->eval_string("(recv c)")) != a->serialize(a->read_string("done")))
+    report("processes");
+  printf("processes %.0f switches per second\n", 400000/std::max(ts - 2*tl, 1e-6));
+  delete a;
+  // throughput of n instances on n threads, ideally constant time per run as n increases
+  double t1 = stress(1, 40);
+  printf("threads,runs,seconds,runs_per_second,speedup\n");
+  printf("1,40,%.3f,%.1f,1.00\n", t1, 40/t1);
+  for (int n = 2; n <= m; n *= 2) {
+    double t = stress(n, 40);
+    printf("%d,%d,%.3f,%.1f,%.2f\n", n, 40*n, t, 40*n/t, n*t1/t);
+  }
+  printf("SUCCESS\n");
+}